@@ -0,0 +1,230 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "server.h"
+
+#define BENCH_PARTS 16
+
+// bench_request
+//   Description:
+//     One simulated request: most are cheap, like a cached static file, and
+//     some are heavy, like compressing a large body, which they do by
+//     splitting the work into parts and waiting for them.
+typedef struct
+{
+    chttp_task task;
+    bool heavy;
+    uint64_t submitted;
+    uint64_t finished;
+    chttp_task parts[BENCH_PARTS];
+} bench_request;
+
+// bench_work
+//   Description:
+//     Iterations of bench_burn making up one microsecond of work, and the
+//     microseconds of work in each kind of task.
+static uint64_t bench_iters_per_us;
+static int bench_cheap_us = 5;
+static int bench_part_us = 50;
+
+// bench_sink
+//   Description:
+//     Where bench_burn leaves its result, so its loop is not optimized away.
+static volatile uint64_t bench_sink;
+
+// bench_now
+//   Returns:
+//     The monotonic clock in nanoseconds.
+static uint64_t bench_now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+// bench_burn
+//   Parameters:
+//     * iters - Number of iterations.
+//
+//   Description:
+//     Spending CPU time in a loop the compiler cannot remove.
+static void bench_burn(uint64_t iters)
+{
+    uint64_t x = 88172645463325252u;
+    for (uint64_t i = 0; i < iters; i++)
+    {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+    }
+    bench_sink = x;
+}
+
+// bench_calibrate
+//   Description:
+//     Measuring how many bench_burn iterations take a microsecond.
+static void bench_calibrate()
+{
+    uint64_t iters = 1 << 20;
+    uint64_t start = bench_now();
+    bench_burn(iters);
+    uint64_t ns = bench_now() - start;
+    bench_iters_per_us = ns ? iters * 1000 / ns : iters;
+    if (bench_iters_per_us == 0)
+        bench_iters_per_us = 1;
+}
+
+// bench_part
+//   Parameters:
+//     * t - One part of a heavy request.
+static void bench_part(chttp_task *t)
+{
+    bench_burn(bench_part_us * bench_iters_per_us);
+}
+
+// bench_serve
+//   Parameters:
+//     * t - The task of a bench_request.
+static void bench_serve(chttp_task *t)
+{
+    bench_request *r = (bench_request *)t;
+    chttp_sched *s = (chttp_sched *)t->arg;
+
+    if (r->heavy)
+    {
+        chttp_task_group group = { 0 };
+        for (int i = 0; i < BENCH_PARTS; i++)
+        {
+            r->parts[i].run = &bench_part;
+            r->parts[i].group = &group;
+            chttp_sched_spawn(s, &r->parts[i]);
+        }
+        chttp_sched_wait(s, &group);
+    } else
+        bench_burn(bench_cheap_us * bench_iters_per_us);
+
+    r->finished = bench_now();
+}
+
+// bench_compare
+//   Description:
+//     Ordering latencies for qsort.
+static int bench_compare(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+// bench_run
+//   Parameters:
+//     * name     - Label for the results.
+//     * stealing - Whether the scheduler steals or shares one queue.
+//     * workers  - Number of worker threads.
+//     * requests - Array of requests to serve.
+//     * count    - Number of requests.
+//     * interval - Nanoseconds between request arrivals.
+//
+//   Description:
+//     Submitting requests at a steady rate from outside the pool, as a
+//     reactor would, and printing the latency percentiles from submission to
+//     completion.
+//
+//   Returns:
+//     -1 on error. 0 on success.
+static int bench_run(const char *name, bool stealing, int workers, bench_request *requests, int count,
+                     uint64_t interval)
+{
+    chttp_sched s;
+    if (chttp_sched_fill(&s, workers, stealing))
+        return -1;
+
+    chttp_task_group all = { 0 };
+    uint64_t start = bench_now();
+    for (int i = 0; i < count; i++)
+    {
+        // Open-loop arrivals: a slow request does not hold back the next.
+        // Sleeping rather than spinning leaves the CPU to the workers.
+        uint64_t due = start + i * interval;
+        struct timespec ts = { due / 1000000000u, due % 1000000000u };
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) != 0)
+            ;
+
+        bench_request *r = &requests[i];
+        r->task.run = &bench_serve;
+        r->task.arg = &s;
+        r->task.group = &all;
+        r->submitted = bench_now();
+        if (chttp_sched_spawn(&s, &r->task))
+            return -1;
+    }
+    chttp_sched_wait(&s, &all);
+    uint64_t elapsed = bench_now() - start;
+
+    size_t steals = 0;
+    for (int i = 0; i < workers; i++)
+        steals += s.workers[i].steals;
+    chttp_sched_stop(&s);
+
+    uint64_t *latency = (uint64_t *)malloc(sizeof(uint64_t) * count);
+    if (latency == NULL)
+        return -1;
+    for (int i = 0; i < count; i++)
+        latency[i] = requests[i].finished - requests[i].submitted;
+    qsort(latency, count, sizeof(uint64_t), &bench_compare);
+
+    printf("%-8s p50 %8.1f us  p99 %8.1f us  p99.9 %8.1f us  max %8.1f us  %.0f req/s  %zu steals\n", name,
+           latency[count / 2] / 1e3, latency[count * 99 / 100] / 1e3, latency[count * 999 / 1000] / 1e3,
+           latency[count - 1] / 1e3, count / (elapsed / 1e9), steals);
+    free(latency);
+    return 0;
+}
+
+// main
+//   Parameters:
+//     * argc - Program-passed argument count.
+//     * argv - Program-passed argument list: workers, requests, the percent of
+//              heavy requests and the target load in percent.
+int main(int argc, char **argv)
+{
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int workers = argc > 1 ? atoi(argv[1]) : (cpus > 1 ? cpus : 2);
+    int count = argc > 2 ? atoi(argv[2]) : 20000;
+    int heavy = argc > 3 ? atoi(argv[3]) : 5;
+    int load = argc > 4 ? atoi(argv[4]) : 70;
+    if (workers < 1 || count < 1 || heavy < 0 || heavy > 100 || load < 1)
+    {
+        fprintf(stderr, "chttp_bench: usage: chttp_bench [workers] [requests] [heavy %%] [load %%]\n");
+        return 1;
+    }
+
+    bench_calibrate();
+
+    // Spacing arrivals so the pool is busy for load percent of the time.
+    double work_us = (heavy * BENCH_PARTS * bench_part_us + (100 - heavy) * bench_cheap_us) / 100.0;
+    uint64_t interval = work_us * 1000 * 100 / load / (cpus < workers ? (cpus > 0 ? cpus : 1) : workers);
+
+    printf("%d workers, %d requests, %d%% heavy (%d x %d us), the rest %d us, %d%% load\n", workers, count, heavy,
+           BENCH_PARTS, bench_part_us, bench_cheap_us, load);
+
+    bench_request *requests = (bench_request *)calloc(count, sizeof(bench_request));
+    if (requests == NULL)
+        return 1;
+
+    // The same sequence of requests for both schedulers.
+    unsigned int seed = 1;
+    for (int i = 0; i < count; i++)
+        requests[i].heavy = rand_r(&seed) % 100 < heavy;
+    if (bench_run("shared", false, workers, requests, count, interval) ||
+        bench_run("stealing", true, workers, requests, count, interval))
+    {
+        fprintf(stderr, "chttp_bench: failed to run.\n");
+        return 1;
+    }
+
+    free(requests);
+    return 0;
+}
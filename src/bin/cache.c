@@ -0,0 +1,461 @@
+#include "server.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+
+// Hashing a path (FNV-1a).
+static unsigned int hash_path(const char *path)
+{
+    unsigned int h = 2166136261u;
+    for (; *path; path++)
+        h = (h ^ (unsigned char)*path) * 16777619u;
+    return h;
+}
+
+// Deriving an entity tag from a file's identity.
+void chttp_file_etag(const struct stat *st, char *buf, size_t len)
+{
+    snprintf(buf, len, "\"%lx-%lx-%lx\"", (unsigned long)st->st_ino, (unsigned long)st->st_size,
+             (unsigned long)st->st_mtim.tv_sec ^ (unsigned long)st->st_mtim.tv_nsec);
+}
+
+// Comparing a file's modification time to another.
+bool chttp_file_older(const struct stat *st, struct timespec t)
+{
+    return st->st_mtim.tv_sec < t.tv_sec || (st->st_mtim.tv_sec == t.tv_sec && st->st_mtim.tv_nsec < t.tv_nsec);
+}
+
+// Finding the MIME type of a file from its suffix.
+const char *chttp_file_type(const char *path)
+{
+    size_t len = strlen(path);
+    const char *suffix = chttp_uri_suffix(path, len);
+    return suffix ? chttp_mime_lookup(suffix, path + len - suffix) : NULL;
+}
+
+// Formatting a time as an HTTP date.
+void chttp_http_date(time_t t, char *buf, size_t len)
+{
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    strftime(buf, len, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+}
+
+// Whether a cached entry still describes the file on disk.
+static bool entry_matches(chttp_cache_entry *e, const struct stat *st)
+{
+    return e->dev == st->st_dev && e->ino == st->st_ino && e->size == st->st_size &&
+        e->mtime.tv_sec == st->st_mtim.tv_sec && e->mtime.tv_nsec == st->st_mtim.tv_nsec;
+}
+
+// Unlinking an entry from the LRU list.
+static void lru_unlink(chttp_cache *cache, chttp_cache_entry *e)
+{
+    if (e->lru_prev != NULL)
+        e->lru_prev->lru_next = e->lru_next;
+    else
+        cache->lru_newest = e->lru_next;
+    if (e->lru_next != NULL)
+        e->lru_next->lru_prev = e->lru_prev;
+    else
+        cache->lru_oldest = e->lru_prev;
+    e->lru_prev = e->lru_next = NULL;
+}
+
+// Making an entry the most recently used.
+static void lru_push(chttp_cache *cache, chttp_cache_entry *e)
+{
+    e->lru_prev = NULL;
+    e->lru_next = cache->lru_newest;
+    if (cache->lru_newest != NULL)
+        cache->lru_newest->lru_prev = e;
+    else
+        cache->lru_oldest = e;
+    cache->lru_newest = e;
+}
+
+// Freeing an entry along with its gzip variant.
+static void entry_free(chttp_cache_entry *e)
+{
+    free(e->gzip);
+    free(e);
+}
+
+// Counting the bytes an entry's bodies take up.
+static size_t entry_bytes(chttp_cache_entry *e)
+{
+    return e->identity.body_len + (e->gzip ? e->gzip->body_len : 0);
+}
+
+// Removing an entry from the cache. Its memory goes once the last connection
+// sending it lets go. Must hold the lock.
+static void cache_remove(chttp_cache *cache, chttp_cache_entry *e)
+{
+    chttp_cache_entry **p = &cache->buckets[e->hash % CHTTP_CACHE_BUCKETS];
+    while (*p != e)
+        p = &(*p)->bucket_next;
+    *p = e->bucket_next;
+
+    lru_unlink(cache, e);
+    cache->bytes -= entry_bytes(e);
+    e->evicted = true;
+    if (e->refs == 0)
+        entry_free(e);
+}
+
+// Finding an entry by path. Must hold the lock.
+static chttp_cache_entry *cache_find(chttp_cache *cache, const char *path, unsigned int hash)
+{
+    for (chttp_cache_entry *e = cache->buckets[hash % CHTTP_CACHE_BUCKETS]; e != NULL; e = e->bucket_next)
+        if (e->hash == hash && strcmp(e->path, path) == 0)
+            return e;
+    return NULL;
+}
+
+// Serializing the response head for one variant of a cached file.
+static size_t entry_head(chttp_cache_entry *e, chttp_cache_variant *v, bool gzip, chttp_connection connection,
+                         char *buf, size_t len)
+{
+    chttp_response res;
+    chttp_response_fill(&res);
+    res.code = 200;
+
+    char value[64];
+    if (e->type != NULL)
+        chttp_add_header(res.headers, "Content-Type", e->type);
+    if (gzip)
+        chttp_add_header(res.headers, "Content-Encoding", "gzip");
+    sprintf(value, "%zu", v->body_len);
+    chttp_add_header(res.headers, "Content-Length", value);
+
+    if (!gzip)
+        chttp_add_header(res.headers, "Accept-Ranges", "bytes");
+    chttp_add_header(res.headers, "ETag", v->etag);
+    chttp_http_date(e->mtime.tv_sec, value, sizeof(value));
+    chttp_add_header(res.headers, "Last-Modified", value);
+    if (chttp_type_compressible(e->type))
+        chttp_add_header(res.headers, "Vary", "Accept-Encoding");
+    if (chttp_connection_value(connection) != NULL)
+        chttp_add_header(res.headers, "Connection", chttp_connection_value(connection));
+
+    size_t n = chttp_sprint_response_head(&res, buf, len);
+    chttp_header_set_free(res.headers);
+    return n;
+}
+
+// Pointing a variant at its heads, at the start of storage, and serializing
+// them. The body follows the heads. Returns -1 if a head does not fit.
+static int variant_fill(chttp_cache_entry *e, chttp_cache_variant *v, bool gzip, char *storage, size_t body_len)
+{
+    for (int i = 0; i < CHTTP_CONNECTION_KINDS; i++)
+        v->head[i] = storage + i * CHTTP_CACHE_HEAD_LENGTH;
+    v->body = storage + CHTTP_CONNECTION_KINDS * CHTTP_CACHE_HEAD_LENGTH;
+    v->body_len = body_len;
+
+    // Each encoding is a different representation, so it needs its own tag.
+    if (gzip)
+        snprintf(v->etag, sizeof(v->etag), "%.*s-gz\"", (int)strlen(e->etag) - 1, e->etag);
+    else
+        strcpy(v->etag, e->etag);
+    for (int i = 0; i < CHTTP_CONNECTION_KINDS; i++)
+    {
+        v->head_len[i] = entry_head(e, v, gzip, (chttp_connection)i, v->head[i], CHTTP_CACHE_HEAD_LENGTH);
+        if (v->head_len[i] == (size_t)-1)
+            return -1;
+    }
+    return 0;
+}
+
+// Reading exactly len bytes of a file. Returns -1 if it came up short.
+static int read_full(int fd, char *buf, size_t len)
+{
+    size_t got = 0;
+    while (got < len)
+    {
+        ssize_t n = read(fd, buf + got, len - got);
+        if (n <= 0)
+            return -1;
+        got += n;
+    }
+    return 0;
+}
+
+// Reading a file into a new entry. Returns NULL if it cannot be cached.
+static chttp_cache_entry *entry_load(chttp_cache *cache, const char *path, unsigned int hash)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return NULL;
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || (size_t)st.st_size > cache->max_file)
+    {
+        close(fd);
+        return NULL;
+    }
+
+    // One allocation holds the entry, its path, the heads and the body.
+    size_t path_len = strlen(path) + 1;
+    chttp_cache_entry *e = (chttp_cache_entry *)malloc(sizeof(chttp_cache_entry) + path_len +
+                                                       CHTTP_CONNECTION_KINDS * CHTTP_CACHE_HEAD_LENGTH + st.st_size);
+    if (e == NULL)
+    {
+        close(fd);
+        return NULL;
+    }
+
+    memset(e, 0, sizeof(chttp_cache_entry));
+    e->cache = cache;
+    e->path = (char *)(e + 1);
+    memcpy(e->path, path, path_len);
+    e->hash = hash;
+    e->dev = st.st_dev;
+    e->ino = st.st_ino;
+    e->size = st.st_size;
+    e->mtime = st.st_mtim;
+    e->checked = time(NULL);
+    chttp_file_etag(&st, e->etag, sizeof(e->etag));
+    e->type = chttp_file_type(path);
+
+    int failed = variant_fill(e, &e->identity, false, e->path + path_len, st.st_size) ||
+        read_full(fd, e->identity.body, st.st_size);
+    close(fd);
+    if (failed)
+    {
+        free(e);
+        return NULL;
+    }
+
+    return e;
+}
+
+// Filling a cache.
+void chttp_cache_fill(chttp_cache *cache, size_t max_bytes, size_t max_file, chttp_sched *sched)
+{
+    memset(cache, 0, sizeof(chttp_cache));
+    pthread_mutex_init(&cache->lock, NULL);
+    cache->max_bytes = max_bytes;
+    cache->max_file = max_file < max_bytes ? max_file : max_bytes;
+    cache->sched = sched;
+}
+
+// Looking up, revalidating or loading a cached file.
+chttp_cache_entry *chttp_cache_get(chttp_cache *cache, const char *path)
+{
+    if (cache->max_bytes == 0)
+        return NULL;
+
+    unsigned int hash = hash_path(path);
+    time_t now = time(NULL);
+
+    pthread_mutex_lock(&cache->lock);
+    chttp_cache_entry *e = cache_find(cache, path, hash);
+    if (e != NULL && now != e->checked)
+    {
+        // Claiming this second's check and holding a reference while the
+        // file is looked at without the lock, so a slow file system stalls
+        // only this lookup; others keep serving the entry meanwhile.
+        e->checked = now;
+        e->refs++;
+        pthread_mutex_unlock(&cache->lock);
+
+        struct stat st;
+        bool found = stat(path, &st) == 0;
+
+        pthread_mutex_lock(&cache->lock);
+        bool fresh = found && entry_matches(e, &st);
+        if (!fresh && !e->evicted)
+            cache_remove(cache, e);
+        if (--e->refs == 0 && e->evicted)
+            entry_free(e);
+
+        // The entry may have been replaced while the lock was let go.
+        e = fresh ? cache_find(cache, path, hash) : NULL;
+    }
+
+    if (e != NULL)
+    {
+        cache->hits++;
+        lru_unlink(cache, e);
+        lru_push(cache, e);
+        e->refs++;
+        pthread_mutex_unlock(&cache->lock);
+        return e;
+    }
+    cache->misses++;
+    pthread_mutex_unlock(&cache->lock);
+
+    // Reading the file without holding the lock, so other reactors keep
+    // serving hits meanwhile.
+    e = entry_load(cache, path, hash);
+    if (e == NULL)
+        return NULL;
+
+    pthread_mutex_lock(&cache->lock);
+    chttp_cache_entry *raced = cache_find(cache, path, hash);
+    if (raced != NULL)
+        cache_remove(cache, raced);
+
+    while (cache->bytes + e->identity.body_len > cache->max_bytes && cache->lru_oldest != NULL)
+    {
+        cache_remove(cache, cache->lru_oldest);
+        cache->evictions++;
+    }
+
+    chttp_cache_entry **bucket = &cache->buckets[hash % CHTTP_CACHE_BUCKETS];
+    e->bucket_next = *bucket;
+    *bucket = e;
+    lru_push(cache, e);
+    cache->bytes += e->identity.body_len;
+    e->refs = 1;
+    pthread_mutex_unlock(&cache->lock);
+
+    return e;
+}
+
+// Dropping a reference to a cached file.
+void chttp_cache_release(void *arg)
+{
+    chttp_cache_entry *e = (chttp_cache_entry *)arg;
+    chttp_cache *cache = e->cache;
+
+    pthread_mutex_lock(&cache->lock);
+    bool dead = --e->refs == 0 && e->evicted;
+    pthread_mutex_unlock(&cache->lock);
+
+    if (dead)
+        entry_free(e);
+}
+
+// Building the gzip variant of an entry from its ".gz" sibling, if that is a
+// regular file small enough to cache and no older than the file itself, since
+// a stale one would be sent under the new file's entity tag. Returns NULL if
+// there is none.
+static chttp_cache_variant *gzip_static(chttp_cache *cache, chttp_cache_entry *e)
+{
+    char path[PATH_MAX];
+    if (snprintf(path, sizeof(path), "%s.gz", e->path) >= (int)sizeof(path))
+        return NULL;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return NULL;
+
+    struct stat st;
+    chttp_cache_variant *v = NULL;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && !chttp_file_older(&st, e->mtime) &&
+        (size_t)st.st_size <= cache->max_file)
+        v = (chttp_cache_variant *)malloc(sizeof(chttp_cache_variant) + CHTTP_CONNECTION_KINDS * CHTTP_CACHE_HEAD_LENGTH +
+                                          st.st_size);
+    if (v != NULL && (variant_fill(e, v, true, (char *)(v + 1), st.st_size) || read_full(fd, v->body, st.st_size)))
+    {
+        free(v);
+        v = NULL;
+    }
+    close(fd);
+    return v;
+}
+
+// Building the gzip variant of an entry by compressing it. Returns NULL if it
+// does not get any smaller.
+static chttp_cache_variant *gzip_compress(chttp_cache *cache, chttp_cache_entry *e, uint64_t *cpu_ns)
+{
+    size_t len;
+    char *data = chttp_gzip(cache->sched, e->identity.body, e->identity.body_len, &len, cpu_ns);
+    if (data == NULL)
+        return NULL;
+
+    chttp_cache_variant *v = NULL;
+    if (len < e->identity.body_len)
+        v = (chttp_cache_variant *)malloc(sizeof(chttp_cache_variant) + CHTTP_CONNECTION_KINDS * CHTTP_CACHE_HEAD_LENGTH +
+                                          len);
+    if (v != NULL)
+    {
+        if (variant_fill(e, v, true, (char *)(v + 1), len) == 0)
+            memcpy(v->body, data, len);
+        else
+        {
+            free(v);
+            v = NULL;
+        }
+    }
+    free(data);
+    return v;
+}
+
+// Getting or making the gzip variant of a cached file.
+chttp_cache_variant *chttp_cache_gzip(chttp_cache *cache, chttp_cache_entry *e)
+{
+    pthread_mutex_lock(&cache->lock);
+    chttp_cache_variant *v = e->gzip;
+    bool tried = e->gzip_tried;
+    if (v != NULL)
+        cache->gzip_hits++;
+    pthread_mutex_unlock(&cache->lock);
+    if (v != NULL || tried || !chttp_type_compressible(e->type))
+        return v;
+
+    // Compressing without holding the lock, like loading a file. Racing
+    // requests for the same file may each compress it; the first to finish
+    // keeps its result.
+    uint64_t cpu_ns = 0;
+    bool from_static = true;
+    v = gzip_static(cache, e);
+    if (v == NULL)
+    {
+        from_static = false;
+        v = gzip_compress(cache, e, &cpu_ns);
+    }
+
+    pthread_mutex_lock(&cache->lock);
+    if (e->gzip_tried)
+    {
+        free(v);
+        v = e->gzip;
+    } else
+    {
+        e->gzip_tried = true;
+        if (v != NULL && !e->evicted)
+        {
+            while (cache->bytes + v->body_len > cache->max_bytes && cache->lru_oldest != NULL &&
+                   cache->lru_oldest != e)
+            {
+                cache_remove(cache, cache->lru_oldest);
+                cache->evictions++;
+            }
+            cache->bytes += v->body_len;
+        }
+        e->gzip = v;
+
+        if (from_static && v != NULL)
+            cache->gzip_static++;
+        else if (!from_static)
+        {
+            cache->gzip_compressed++;
+            cache->gzip_in += e->identity.body_len;
+            cache->gzip_out += v ? v->body_len : e->identity.body_len;
+            cache->gzip_cpu_ns += cpu_ns;
+        }
+    }
+    pthread_mutex_unlock(&cache->lock);
+
+    return v;
+}
+
+// Printing the cache's counters.
+void chttp_cache_print_stats(chttp_cache *cache, FILE *f)
+{
+    pthread_mutex_lock(&cache->lock);
+    fprintf(f, "cache: %zu hits, %zu misses, %zu evictions, %zu/%zu bytes\n",
+            cache->hits, cache->misses, cache->evictions, cache->bytes, cache->max_bytes);
+    fprintf(f, "gzip: %zu hits, %zu from .gz files, %zu compressed, %zu -> %zu bytes (%.1f%%), %.3f ms CPU\n",
+            cache->gzip_hits, cache->gzip_static, cache->gzip_compressed, cache->gzip_in, cache->gzip_out,
+            cache->gzip_in ? 100.0 * cache->gzip_out / cache->gzip_in : 0.0, cache->gzip_cpu_ns / 1e6);
+    pthread_mutex_unlock(&cache->lock);
+    fflush(f);
+}
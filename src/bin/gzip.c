@@ -0,0 +1,277 @@
+#include "server.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+#include <zlib.h>
+
+// Parsing the q-value among the parameters of one Accept-Encoding element,
+// which run from s to end. Anything unparsable counts as 1.
+static double coding_quality(const char *s, const char *end)
+{
+    while (s < end)
+    {
+        while (s < end && (*s == ';' || *s == ' ' || *s == '\t'))
+            s++;
+        if (end - s >= 2 && (s[0] == 'q' || s[0] == 'Q') && s[1] == '=')
+            return strtod(s + 2, NULL);
+        while (s < end && *s != ';')
+            s++;
+    }
+    return 1;
+}
+
+// Checking whether a client accepts gzip.
+bool chttp_accepts_gzip(const char *value)
+{
+    double gzip = -1;
+    double any = -1;
+    while (value != NULL && *value)
+    {
+        while (*value == ' ' || *value == '\t' || *value == ',')
+            value++;
+        const char *end = strchr(value, ',');
+        if (end == NULL)
+            end = value + strlen(value);
+
+        size_t len = strcspn(value, ";, \t");
+        if (len > (size_t)(end - value))
+            len = end - value;
+        if ((len == 4 && strncasecmp(value, "gzip", 4) == 0) || (len == 6 && strncasecmp(value, "x-gzip", 6) == 0))
+            gzip = coding_quality(value + len, end);
+        else if (len == 1 && *value == '*')
+            any = coding_quality(value + len, end);
+        value = end;
+    }
+
+    // An explicit gzip element takes precedence over "*".
+    return gzip >= 0 ? gzip > 0 : any > 0;
+}
+
+// Checking whether a type compresses well.
+bool chttp_type_compressible(const char *type)
+{
+    if (type == NULL)
+        return false;
+    if (strncmp(type, "text/", 5) == 0)
+        return true;
+
+    static const char *const types[] = {
+        "application/json", "application/javascript", "application/xml", "application/wasm",
+        "application/yaml", "application/rtf", "application/x-sh", "image/svg+xml",
+        "image/vnd.microsoft.icon", "font/ttf", "font/otf", "application/vnd.ms-fontobject",
+    };
+    for (size_t i = 0; i < sizeof(types) / sizeof(types[0]); i++)
+        if (strcmp(type, types[i]) == 0)
+            return true;
+
+    // Structured syntax suffixes, as in application/rss+xml.
+    size_t len = strlen(type);
+    return (len > 4 && strcmp(type + len - 4, "+xml") == 0) || (len > 5 && strcmp(type + len - 5, "+json") == 0);
+}
+
+// Getting the calling thread's CPU time in nanoseconds.
+static uint64_t thread_cpu_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+// Compressing a buffer into gzip format in one pass.
+static char *gzip_whole(const char *data, size_t len, size_t *out_len, uint64_t *cpu_ns)
+{
+    uint64_t start = thread_cpu_ns();
+
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    // A window of 15 bits plus 16 asks zlib for a gzip header and trailer.
+    if (deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        return NULL;
+
+    size_t size = deflateBound(&zs, len);
+    char *out = (char *)malloc(size);
+    if (out == NULL)
+    {
+        deflateEnd(&zs);
+        return NULL;
+    }
+
+    zs.next_in = (Bytef *)data;
+    zs.avail_in = len;
+    zs.next_out = (Bytef *)out;
+    zs.avail_out = size;
+    int r = deflate(&zs, Z_FINISH);
+    *out_len = zs.total_out;
+    deflateEnd(&zs);
+    if (r != Z_STREAM_END)
+    {
+        free(out);
+        return NULL;
+    }
+
+    *cpu_ns = thread_cpu_ns() - start;
+    return out;
+}
+
+// One part of a buffer compressed on its own, as raw deflate blocks that end
+// on a byte boundary so the parts can be joined. The 32 KB before the part
+// are its dictionary, so the split costs next to nothing in ratio.
+typedef struct
+{
+    chttp_task task;
+    const char *data;
+    size_t len;
+    size_t dict_len;
+    bool last;
+
+    char *out;
+    size_t out_len;
+    uLong crc;
+    uint64_t cpu_ns;
+} gzip_part;
+
+// Compressing a part.
+static void gzip_part_run(chttp_task *t)
+{
+    gzip_part *p = (gzip_part *)t;
+    uint64_t start = thread_cpu_ns();
+
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    if (deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        return;
+    if (p->dict_len > 0 && deflateSetDictionary(&zs, (const Bytef *)p->data - p->dict_len, p->dict_len) != Z_OK)
+    {
+        deflateEnd(&zs);
+        return;
+    }
+
+    // A sync flush ends the part with an empty stored block, which the bound
+    // leaves out.
+    size_t size = deflateBound(&zs, p->len) + 16;
+    char *out = (char *)malloc(size);
+    if (out != NULL)
+    {
+        zs.next_in = (Bytef *)p->data;
+        zs.avail_in = p->len;
+        zs.next_out = (Bytef *)out;
+        zs.avail_out = size;
+        int r = deflate(&zs, p->last ? Z_FINISH : Z_SYNC_FLUSH);
+        if (p->last ? r == Z_STREAM_END : r == Z_OK && zs.avail_in == 0 && zs.avail_out > 0)
+        {
+            p->out = out;
+            p->out_len = zs.total_out;
+        } else
+            free(out);
+    }
+    deflateEnd(&zs);
+
+    p->crc = crc32(0, (const Bytef *)p->data, p->len);
+    p->cpu_ns = thread_cpu_ns() - start;
+}
+
+// Compressing a buffer as a task that splits itself into parts, which go on
+// the worker's own deque for the others to steal.
+typedef struct
+{
+    chttp_task task;
+    chttp_sched *sched;
+    gzip_part *parts;
+    int count;
+} gzip_job;
+
+// Spawning the parts of a job and waiting for them.
+static void gzip_job_run(chttp_task *t)
+{
+    gzip_job *job = (gzip_job *)t;
+    chttp_task_group group = { 0 };
+    for (int i = 0; i < job->count; i++)
+    {
+        job->parts[i].task.run = &gzip_part_run;
+        job->parts[i].task.group = &group;
+        if (chttp_sched_spawn(job->sched, &job->parts[i].task))
+            gzip_part_run(&job->parts[i].task);
+    }
+    chttp_sched_wait(job->sched, &group);
+}
+
+// Writing a 32-bit value least significant byte first, as gzip stores them.
+static void put_le32(unsigned char *p, uint32_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+// Compressing a buffer in parts on a scheduler and joining them into one gzip
+// member, with the parts' checksums combined rather than recomputed.
+static char *gzip_parallel(chttp_sched *s, const char *data, size_t len, size_t *out_len, uint64_t *cpu_ns)
+{
+    int count = (len + CHTTP_GZIP_PART_LENGTH - 1) / CHTTP_GZIP_PART_LENGTH;
+    gzip_part *parts = (gzip_part *)calloc(count, sizeof(gzip_part));
+    if (parts == NULL)
+        return NULL;
+    for (int i = 0; i < count; i++)
+    {
+        size_t off = (size_t)i * CHTTP_GZIP_PART_LENGTH;
+        parts[i].data = data + off;
+        parts[i].len = len - off < CHTTP_GZIP_PART_LENGTH ? len - off : CHTTP_GZIP_PART_LENGTH;
+        parts[i].dict_len = off < 32768 ? off : 32768;
+        parts[i].last = i == count - 1;
+    }
+
+    // The calling thread is a reactor, not a worker, so it sleeps until the
+    // parts are done rather than taking a core from the workers.
+    chttp_task_group group = { 0 };
+    gzip_job job = { { &gzip_job_run, NULL, &group }, s, parts, count };
+    if (chttp_sched_spawn(s, &job.task))
+        gzip_job_run(&job.task);
+    chttp_sched_wait(s, &group);
+
+    size_t total = 10 + 8;
+    bool failed = false;
+    for (int i = 0; i < count; i++)
+    {
+        total += parts[i].out_len;
+        failed = failed || parts[i].out == NULL;
+    }
+
+    unsigned char *out = failed ? NULL : (unsigned char *)malloc(total);
+    if (out != NULL)
+    {
+        // The header zlib writes itself: no name or time, Unix.
+        static const unsigned char header[10] = { 0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 3 };
+        memcpy(out, header, sizeof(header));
+        size_t n = sizeof(header);
+        uLong crc = parts[0].crc;
+        *cpu_ns = 0;
+        for (int i = 0; i < count; i++)
+        {
+            memcpy(out + n, parts[i].out, parts[i].out_len);
+            n += parts[i].out_len;
+            if (i > 0)
+                crc = crc32_combine(crc, parts[i].crc, parts[i].len);
+            *cpu_ns += parts[i].cpu_ns;
+        }
+        put_le32(out + n, crc);
+        put_le32(out + n + 4, (uint32_t)len);
+        *out_len = total;
+    }
+
+    for (int i = 0; i < count; i++)
+        free(parts[i].out);
+    free(parts);
+    return (char *)out;
+}
+
+// Compressing a buffer into gzip format.
+char *chttp_gzip(chttp_sched *s, const char *data, size_t len, size_t *out_len, uint64_t *cpu_ns)
+{
+    if (s == NULL || len < 2 * CHTTP_GZIP_PART_LENGTH)
+        return gzip_whole(data, len, out_len, cpu_ns);
+    return gzip_parallel(s, data, len, out_len, cpu_ns);
+}
@@ -0,0 +1,91 @@
+#include "server.h"
+
+#include <errno.h>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <unistd.h>
+
+// Turning a connection away.
+void chttp_shed(int sock)
+{
+    static const char tail[] = "Content-Length: 0\r\nConnection: close\r\n\r\n";
+    struct iovec iov[2];
+    iov[0].iov_base = (void *)chttp_status_line(503, &iov[0].iov_len);
+    iov[1].iov_base = (void *)tail;
+    iov[1].iov_len = sizeof(tail) - 1;
+
+    // Closing with unread input makes the kernel reset the connection, which
+    // can destroy the response before the client reads it, so whatever of the
+    // request has arrived is read first.
+    char discard[4096];
+    while (recv(sock, discard, sizeof(discard), MSG_DONTWAIT) > 0)
+        ;
+
+    // A fresh socket's send buffer is empty, so this either goes out whole or
+    // the client is gone anyway.
+    struct msghdr msg = { 0 };
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2;
+    sendmsg(sock, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+    shutdown(sock, SHUT_WR);
+    close(sock);
+}
+
+// Accepting connections for a ring of reactors.
+int chttp_acceptor_run(int listener, chttp_ring *ring, chttp_reactor **reactors, int count, _Atomic size_t *shed)
+{
+    struct pollfd pfd;
+    pfd.fd = listener;
+    pfd.events = POLLIN;
+
+    int next = 0;
+    while (1)
+    {
+        if (poll(&pfd, 1, -1) < 0 && errno != EINTR)
+            return -1;
+
+        // The signal most likely interrupted this thread rather than a
+        // reactor.
+        if (chttp_stats_requested)
+        {
+            chttp_stats_requested = 0;
+            chttp_server_print_stats(stdout);
+        }
+
+        while (1)
+        {
+            int sock = accept4(listener, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (sock < 0)
+            {
+                if (errno == EINTR || errno == ECONNABORTED)
+                    continue;
+                if (errno == EAGAIN || errno == EWOULDBLOCK)
+                    break;
+
+                // Out of descriptors or memory: the backlog keeps the
+                // connections until the reactors have closed some.
+                if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM)
+                {
+                    poll(NULL, 0, 10);
+                    break;
+                }
+                return -1;
+            }
+
+            int opt = 1;
+            setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+
+            if (!chttp_ring_push(ring, sock))
+            {
+                atomic_fetch_add_explicit(shed, 1, memory_order_relaxed);
+                chttp_shed(sock);
+                continue;
+            }
+            chttp_reactor_wake(reactors[next]);
+            next = (next + 1) % count;
+        }
+    }
+}
@@ -3,12 +3,20 @@
 #include <string.h>
 #include <stdio.h>
 #include <errno.h>
+#include <stdatomic.h>
 
 #if defined(__unix__) || (defined(__APPLE__) && defined(__MACH__))
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <arpa/inet.h>
+#include <signal.h>
 #include <pthread.h>
+#include <sched.h>
 #include <unistd.h>
 #include <getopt.h>
 #else
@@ -16,6 +24,7 @@
 #endif
 
 #include "../lib/chttp.h"
+#include "server.h"
 
 // chttp_print_error
 //   Parameters:
@@ -47,21 +56,28 @@ void chttp_print_help(FILE *f)
     fprintf(f, "  --help          Display this page.\n");
     fprintf(f, "  --address (-a)  Set the IP address (\"all\"=listen on all addresses.)\n");
     fprintf(f, "  --port (-p)     Set the port.\n");
+    fprintf(f, "  --workers (-w)  Number of reactor threads, each with its own listener.\n");
+    fprintf(f, "  --pin           Pin each reactor thread to its own CPU.\n");
+    fprintf(f, "  --accept-queue  Accept on one thread and hand connections to the reactors\n");
+    fprintf(f, "                  through a queue of this size, 0=a listener per reactor\n");
+    fprintf(f, "                  (default 0). Connections are shed with 503 when it is full.\n");
+    fprintf(f, "  --max-connections\n");
+    fprintf(f, "                  Connections per reactor before new ones are shed with 503,\n");
+    fprintf(f, "                  0=unlimited (default 0).\n");
+    fprintf(f, "  --keepalive-timeout (-t)\n");
+    fprintf(f, "                  Seconds an idle connection is kept open (default 5).\n");
+    fprintf(f, "  --max-requests (-m)\n");
+    fprintf(f, "                  Requests served per connection, 0=unlimited (default 100).\n");
+    fprintf(f, "  --gzip-threads  Threads compressing large cached files in parallel parts,\n");
+    fprintf(f, "                  0=compress on the reactor (default 0).\n");
+    fprintf(f, "  --cache-size    Bytes of small files kept in memory, 0=off (default 64M).\n");
+    fprintf(f, "  --cache-file-max\n");
+    fprintf(f, "                  Largest file kept in memory (default 1M).\n");
+    fprintf(f, "  --autoindex     List directories without an index.html.\n");
+    fprintf(f, "  --mime-types    Load MIME types from a mime.types file.\n");
+    fprintf(f, "Send SIGUSR1 to print server statistics.\n");
 }
 
-// chttp_server_args
-//   Description:
-//     Structured container for server arguments.
-struct chttp_server_args
-{
-    char address[16];
-    uint16_t port;
-    int backlog;
-    bool help;
-    bool verbose;
-};
-typedef struct chttp_server_args chttp_server_args;
-
 // chttp_server_args_parse
 //   Parameters:
 //     * argc - Argument count.
@@ -79,6 +95,12 @@ int chttp_server_args_parse(int argc, char **argv, chttp_server_args *args)
     memset(args, 0, sizeof(chttp_server_args));
     strncpy(args->address, "all", 16);
     args->port = 3000;
+    args->backlog = SOMAXCONN;
+    args->workers = 1;
+    args->keepalive_timeout = 5;
+    args->max_requests = 100;
+    args->cache_size = 64 * 1024 * 1024;
+    args->cache_file_max = 1024 * 1024;
 
     struct option options[] =
     {
@@ -87,13 +109,24 @@ int chttp_server_args_parse(int argc, char **argv, chttp_server_args *args)
 
         { "address", required_argument, 0, 'a' },
         { "port"   , required_argument, 0, 'p' },
+        { "workers", required_argument, 0, 'w' },
+        { "pin"    , no_argument      , 0, 'P' },
+        { "accept-queue"     , required_argument, 0, 'Q' },
+        { "max-connections"  , required_argument, 0, 'N' },
+        { "keepalive-timeout", required_argument, 0, 't' },
+        { "max-requests"     , required_argument, 0, 'm' },
+        { "gzip-threads"     , required_argument, 0, 'Z' },
+        { "cache-size"       , required_argument, 0, 'C' },
+        { "cache-file-max"   , required_argument, 0, 'F' },
+        { "autoindex"        , no_argument      , 0, 'I' },
+        { "mime-types"       , required_argument, 0, 'M' },
 
         { 0, 0, 0, 0 }
     };
 
     int idx = 0;
     int c;
-    while ((c = getopt_long(argc, argv, "hva:p:", options, &idx)) >= 0)
+    while ((c = getopt_long(argc, argv, "hva:p:w:t:m:", options, &idx)) >= 0)
     {
         switch (c)
         {
@@ -110,6 +143,40 @@ int chttp_server_args_parse(int argc, char **argv, chttp_server_args *args)
             break;
         case 'p':
             args->port = atoi(optarg);
+            break;
+        case 'w':
+            args->workers = atoi(optarg);
+            break;
+        case 'P':
+            args->pin = 1;
+            break;
+        case 'Q':
+            args->accept_queue = atoi(optarg);
+            break;
+        case 'N':
+            args->max_connections = atoi(optarg);
+            break;
+        case 't':
+            args->keepalive_timeout = atoi(optarg);
+            break;
+        case 'm':
+            args->max_requests = atoi(optarg);
+            break;
+        case 'Z':
+            args->gzip_threads = atoi(optarg);
+            break;
+        case 'C':
+            args->cache_size = strtoull(optarg, NULL, 10);
+            break;
+        case 'F':
+            args->cache_file_max = strtoull(optarg, NULL, 10);
+            break;
+        case 'I':
+            args->autoindex = 1;
+            break;
+        case 'M':
+            args->mime_types = optarg;
+            break;
         default:
             return 1;
             break;
@@ -130,7 +197,14 @@ int chttp_server_args_parse(int argc, char **argv, chttp_server_args *args)
 //     -1 if invalid. 0 if valid.
 int chttp_server_args_validate(chttp_server_args args)
 {
-    // TODO
+    if (args.workers < 1 || args.workers > CHTTP_MAX_WORKERS)
+        return -1;
+    if (args.keepalive_timeout < 1 || args.max_requests < 0)
+        return -1;
+    if (args.accept_queue < 0 || args.max_connections < 0)
+        return -1;
+    if (args.gzip_threads < 0 || args.gzip_threads > CHTTP_MAX_WORKERS)
+        return -1;
     return 0;
 }
 
@@ -181,7 +255,7 @@ int chttp_config_sockaddr(chttp_server_args args, struct sockaddr_in *serv_addr)
 //     -1 on error. 0 on success.
 int chttp_create_server(chttp_server_args args, int *sock)
 {
-    *sock = socket(AF_INET, SOCK_STREAM, 0);
+    *sock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
     if (*sock == -1)
         return -1;
 
@@ -192,6 +266,15 @@ int chttp_create_server(chttp_server_args args, int *sock)
         return -1;
     }
 
+    // With several workers each binds its own listener to the same port and
+    // the kernel spreads incoming connections across them, unless a single
+    // acceptor hands them out.
+    if (args.workers > 1 && args.accept_queue == 0 && setsockopt(*sock, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0)
+    {
+        chttp_kill_socket(*sock);
+        return -1;
+    }
+
     // Configuring the socket address.
     struct sockaddr_in serv_addr;
     if (chttp_config_sockaddr(args, &serv_addr) < 0)
@@ -215,102 +298,754 @@ int chttp_create_server(chttp_server_args args, int *sock)
     return 0;
 }
 
-// chttp_client
+// chttp_file_cache
+//   Description:
+//     Cache of small files under the document root, shared by every worker.
+static chttp_cache chttp_file_cache;
+
+// chttp_gzip_sched
+//   Description:
+//     Worker threads compressing large files for the cache, if any.
+static chttp_sched chttp_gzip_sched;
+
+// chttp_routes
+//   Description:
+//     Handlers by method and path, built before any worker starts.
+static chttp_router chttp_routes;
+
+// chttp_autoindex
+//   Description:
+//     Whether directories without an index.html are listed.
+static bool chttp_autoindex;
+
+// chttp_respond_headers
+//   Parameters:
+//     * c       - The connection.
+//     * code    - The status code.
+//     * headers - Header lines ending in CRLF, or an empty string.
+//
+//   Description:
+//     Sending a response without a body, from static pieces and the given
+//     headers.
+//
+//   Returns:
+//     -1 if the connection should be dropped. 0 on success.
+static int chttp_respond_headers(chttp_conn *c, int code, const char *headers)
+{
+    static const char length[] = "Content-Length: 0\r\n";
+    static const char *const tails[CHTTP_CONNECTION_KINDS] = {
+        [CHTTP_CONNECTION_DEFAULT] = "\r\n",
+        [CHTTP_CONNECTION_CLOSE] = "Connection: close\r\n\r\n",
+        [CHTTP_CONNECTION_KEEP_ALIVE] = "Connection: keep-alive\r\n\r\n",
+    };
+
+    struct iovec iov[4];
+    iov[0].iov_base = (void *)chttp_status_line(code, &iov[0].iov_len);
+    iov[1].iov_base = (void *)length;
+    iov[1].iov_len = sizeof(length) - 1;
+    iov[2].iov_base = (void *)headers;
+    iov[2].iov_len = strlen(headers);
+    iov[3].iov_base = (void *)tails[chttp_conn_connection(c)];
+    iov[3].iov_len = strlen((const char *)iov[3].iov_base);
+    return chttp_conn_writev(c, iov, 4);
+}
+
+// chttp_respond_empty
+//   Parameters:
+//     * c    - The connection.
+//     * code - The status code.
+//
+//   Description:
+//     Sending a response without a body, from static pieces.
+//
+//   Returns:
+//     -1 if the connection should be dropped. 0 on success.
+int chttp_respond_empty(chttp_conn *c, int code)
+{
+    return chttp_respond_headers(c, code, "");
+}
+
+// chttp_respond_not_allowed
+//   Parameters:
+//     * c     - The connection.
+//     * allow - The methods the path takes, as bits by chttp_method.
+//
+//   Description:
+//     Sending a 405 with the Allow header it must carry. The header is built
+//     in the connection's arena, since the write queue only refers to it.
+//
+//   Returns:
+//     -1 if the connection should be dropped. 0 on success.
+static int chttp_respond_not_allowed(chttp_conn *c, int allow)
+{
+    char *header = (char *)chttp_arena_alloc(chttp_conn_arena(c), CHTTP_ALLOW_LENGTH);
+    if (header == NULL)
+        return -1;
+
+    char *p = stpcpy(header, "Allow: ");
+    for (int m = OPTIONS; m < OTHER; m++)
+    {
+        if (allow & (1 << m))
+            p += sprintf(p, "%s%s", p[-1] == ' ' ? "" : ", ", chttp_method_name((chttp_method)m));
+    }
+    strcpy(p, "\r\n");
+    return chttp_respond_headers(c, 405, header);
+}
+
+// chttp_respond
+//   Parameters:
+//     * c   - The connection the request arrived on.
+//     * req - The parsed request.
+//
+//   Description:
+//     Handling a request from a given client by handing it to the route its
+//     path matches. The path is decoded and normalized first, so routes and
+//     handlers only see paths without escapes or dot segments, and requests
+//     climbing above the root are refused.
+//
+//   Returns:
+//     -1 if the connection should be dropped. 0 on success.
+int chttp_respond(chttp_conn *c, chttp_request *req)
+{
+    chttp_uri u;
+    char path[CHTTP_URI_LENGTH + 1];
+    long path_len = -1;
+    if (chttp_uri_split(req->uri, strlen(req->uri), &u) == 0 && u.path_len < sizeof(path))
+    {
+        // The absolute form may leave the path empty.
+        memcpy(path, u.path_len ? u.path : "/", u.path_len ? u.path_len : 1);
+        path_len = chttp_path_clean(path, u.path_len ? u.path_len : 1);
+    }
+    if (path_len < 0)
+        return chttp_respond_empty(c, 400);
+
+    chttp_route_match match;
+    switch (chttp_router_match(&chttp_routes, req->method, path, path_len, &match))
+    {
+    case CHTTP_ROUTE_FOUND:
+        return match.handler(c, req, &match);
+    case CHTTP_ROUTE_METHOD_NOT_ALLOWED:
+        return chttp_respond_not_allowed(c, match.allow);
+    default:
+        return chttp_respond_empty(c, 404);
+    }
+}
+
+// chttp_worker
 //   Description:
-//     Structure to pass along client information to a response thread.
-struct chttp_client
+//     One reactor thread along with the listener it owns.
+struct chttp_worker
 {
-    socklen_t addr_size;
+    pthread_t thread;
+    int id;
     int sock;
-    struct sockaddr_in addr;
+    bool pin;
+    chttp_reactor reactor;
 };
-typedef struct chttp_client chttp_client;
+typedef struct chttp_worker chttp_worker;
 
-// chttp_respond
+// chttp_workers
+//   Description:
+//     The reactor threads, for their counters.
+static chttp_worker *chttp_workers;
+static int chttp_worker_count;
+
+// chttp_accept_shed
+//   Description:
+//     Connections the acceptor shed because the handoff queue was full.
+static _Atomic size_t chttp_accept_shed;
+
+volatile sig_atomic_t chttp_stats_requested = 0;
+
+// chttp_request_stats
 //   Parameters:
-//     * cli - Client pointer. Contains all information from accepting the
-//             socket.
+//     * sig - The signal number.
 //
 //   Description:
-//     Handling a request from a given client. Under default behavior, sends a
-//     given file back to a client with appropriate headers.
-void *chttp_respond(void *arg)
+//     SIGUSR1 handler asking the reactors to print statistics.
+void chttp_request_stats(int sig)
 {
-    chttp_client *cli = (chttp_client *)arg;
-    pthread_detach(pthread_self());
-
-    // Getting the content.
-    // TODO: Currently chunking it because I could not come up with a
-    // sufficiently non-blocking solution to reading data from a socket whose
-    // data is not yet always ready, but does not EOF or \0 out.
-    const int content_length = CHTTP_BODY_LENGTH * 2;
-    char content[content_length];
-    read(cli->sock, content, content_length);
-
-    // Setting up the request.
-    chttp_request req;
-    chttp_request_fill(&req);
-    chttp_sparse_request(&req, content, strlen(content));
-
-    // Calculating the correct uri.
-    const int uri_length = CHTTP_URI_LENGTH + 14;
-    char uri[uri_length];
-    sprintf(uri, "www%s%s", req.uri, req.uri[strlen(req.uri) - 1] == '/' ? "index.html" : "");
+    chttp_stats_requested = 1;
+}
 
-    // Creating a base response.
-    chttp_response res;
-    chttp_response_fill(&res);
-    strcpy(res.http_version, "HTTP/1.1");
+// chttp_server_print_stats
+//   Parameters:
+//     * f - File pointer to print to.
+//
+//   Description:
+//     Printing the server-wide counters.
+void chttp_server_print_stats(FILE *f)
+{
+    size_t shed = 0;
+    for (int i = 0; i < chttp_worker_count; i++)
+        shed += atomic_load_explicit(&chttp_workers[i].reactor.shed, memory_order_relaxed);
+    fprintf(f, "shed: %zu at the connection limit, %zu with the accept queue full\n", shed,
+            atomic_load_explicit(&chttp_accept_shed, memory_order_relaxed));
+    chttp_cache_print_stats(&chttp_file_cache, f);
+}
 
-    // Filling it with the appropriate data.
-    FILE *f = fopen(uri, "r");
-    if (!f)
+// chttp_append_escaped
+//   Parameters:
+//     * buf  - Buffer to append to.
+//     * n    - Bytes already in buf, advanced past the appended text.
+//     * str  - Text to append.
+//     * href - Whether str goes in a URL rather than in HTML text.
+//
+//   Description:
+//     Appending str with HTML special characters escaped, or for a URL with
+//     everything but unreserved characters and '/' percent-encoded. buf needs
+//     room for six times the length of str.
+void chttp_append_escaped(char *buf, size_t *n, const char *str, bool href)
+{
+    for (const unsigned char *p = (const unsigned char *)str; *p; p++)
     {
-        res.code = 404;
-        strcpy(res.reason_phrase, "Not found.");
-        sprintf(res.body, "Error 404, file not found: %s\n", uri);
-    } else
+        if (href)
+        {
+            if (isalnum(*p) || strchr("-._~/", *p) != NULL)
+                buf[(*n)++] = *p;
+            else
+                *n += sprintf(buf + *n, "%%%02X", *p);
+        } else if (*p == '&')
+            *n += sprintf(buf + *n, "&amp;");
+        else if (*p == '<')
+            *n += sprintf(buf + *n, "&lt;");
+        else if (*p == '>')
+            *n += sprintf(buf + *n, "&gt;");
+        else if (*p == '"')
+            *n += sprintf(buf + *n, "&quot;");
+        else
+            buf[(*n)++] = *p;
+    }
+}
+
+// chttp_list_directory
+//   Parameters:
+//     * c   - The connection the request arrived on.
+//     * req - The parsed request.
+//     * res - A response to fill in.
+//     * dir - The directory to list, closed before returning.
+//
+//   Description:
+//     Sending an HTML listing of a directory as a chunked response. Entries
+//     are batched into chunks of a few kilobytes, and each chunk goes out as
+//     soon as it is full rather than once the whole listing is built.
+//
+//   Returns:
+//     -1 if the connection should be dropped. 0 on success.
+int chttp_list_directory(chttp_conn *c, chttp_request *req, chttp_response *res, DIR *dir)
+{
+    res->code = 200;
+    chttp_add_header(res->headers, "Content-Type", "text/html; charset=utf-8");
+    const char *connection = chttp_connection_value(chttp_conn_connection(c));
+    if (connection != NULL)
+        chttp_add_header(res->headers, "Connection", connection);
+
+    chttp_chunked_writer w;
+    if (chttp_chunked_begin(&w, res, &chttp_conn_sink, c))
     {
-        res.code = 200;
-        strcpy(res.reason_phrase, "OK");
-        fread(res.body, 1, CHTTP_BODY_LENGTH, f);
-        fclose(f);
+        closedir(dir);
+        return -1;
+    }
+    if (req->method == HEAD)
+    {
+        closedir(dir);
+        return 0;
     }
 
-    const int output_length = CHTTP_BODY_LENGTH + 1024;
-    char output[output_length];
-    chttp_sprint_response(&res, output, output_length);
+    const size_t chunk_length = 8192;
+    char chunk[chunk_length];
+    size_t n = sprintf(chunk, "<!doctype html>\n<html><head><title>Index of ");
+    chttp_append_escaped(chunk, &n, req->uri, false);
+    n += sprintf(chunk + n, "</title></head><body><ul>\n");
 
-    write(cli->sock, output, strlen(output));
+    int failed = 0;
+    struct dirent *e;
+    while (!failed && (e = readdir(dir)) != NULL)
+    {
+        if (strcmp(e->d_name, ".") == 0)
+            continue;
+
+        // Room for a name escaped twice, plus the markup around it.
+        if (n + 12 * sizeof(e->d_name) > chunk_length)
+        {
+            failed = chttp_chunked_write(&w, chunk, n);
+            n = 0;
+        }
 
-    chttp_header_set_free(res.headers);
-    chttp_kill_socket(cli->sock);
-    free(cli);
+        const char *slash = e->d_type == DT_DIR ? "/" : "";
+        n += sprintf(chunk + n, "<li><a href=\"");
+        chttp_append_escaped(chunk, &n, e->d_name, true);
+        n += sprintf(chunk + n, "%s\">", slash);
+        chttp_append_escaped(chunk, &n, e->d_name, false);
+        n += sprintf(chunk + n, "%s</a></li>\n", slash);
+    }
+    closedir(dir);
 
-    pthread_exit(NULL);
+    n += sprintf(chunk + n, "</ul></body></html>\n");
+    if (failed || chttp_chunked_write(&w, chunk, n) || chttp_chunked_end(&w, NULL))
+        return -1;
+    return 0;
 }
 
-// chttp_handle_client
+// chttp_open_gzip_sibling
 //   Parameters:
-//     * cli - Client pointer. Contains all information from accepting the
-//             socket.
+//     * path - Path of a file.
+//     * st   - The file's metadata, replaced with the sibling's on success.
+//
+//   Returns:
+//     An open descriptor for the regular file path + ".gz", or -1 if there is
+//     none or it is older than the file, and so may hold an earlier version.
+static int chttp_open_gzip_sibling(const char *path, struct stat *st)
+{
+    char gz[PATH_MAX];
+    if (snprintf(gz, sizeof(gz), "%s.gz", path) >= (int)sizeof(gz))
+        return -1;
+
+    struct stat gz_st;
+    int fd = open(gz, O_RDONLY | O_CLOEXEC);
+    if (fd >= 0 && (fstat(fd, &gz_st) < 0 || !S_ISREG(gz_st.st_mode) || chttp_file_older(&gz_st, st->st_mtim)))
+    {
+        close(fd);
+        return -1;
+    }
+    if (fd >= 0)
+        *st = gz_st;
+    return fd;
+}
+
+// chttp_file
+//   A representation of a file ready to be sent: either a cached variant,
+//   whose entry is referenced, or an open descriptor.
+typedef struct
+{
+    chttp_cache_entry *entry;
+    const char *body;
+    int fd;
+    size_t size;
+    const char *type;
+    const char *etag;
+    time_t mtime;
+    bool gzip;
+} chttp_file;
+
+// chttp_file_release
+//   Parameters:
+//     * f - The file.
 //
 //   Description:
-//     Spawns a thread to handle the given client connection.
+//     Dropping the cache reference or descriptor of a file that will not be
+//     sent, or not sent any further.
+static void chttp_file_release(chttp_file *f)
+{
+    if (f->entry != NULL)
+        chttp_cache_release(f->entry);
+    else
+        close(f->fd);
+}
+
+// chttp_not_modified
+//   Parameters:
+//     * req - The request.
+//     * f   - The file it asks for.
 //
 //   Returns:
-//     -1 if error. 0 if success.
-int chttp_handle_client(chttp_client *cli)
+//     Whether the client's copy is current, so a 304 will do. If-None-Match
+//     takes precedence over If-Modified-Since, as RFC 9110 requires.
+static bool chttp_not_modified(chttp_request *req, chttp_file *f)
 {
-    pthread_t thread;
-    if (pthread_create(&thread, NULL, &chttp_respond, (void *)cli))
+    if (req->method != GET && req->method != HEAD)
+        return false;
+
+    const char *none_match = chttp_get_header(req->headers, "If-None-Match");
+    if (none_match != NULL)
+        return chttp_etag_match(none_match, f->etag, 1);
+
+    const char *since = chttp_get_header(req->headers, "If-Modified-Since");
+    time_t t;
+    return since != NULL && chttp_parse_http_date(since, &t) == 0 && f->mtime <= t;
+}
+
+// chttp_file_ranges
+//   Parameters:
+//     * req    - The request.
+//     * f      - The file it asks for.
+//     * ranges - Filled with the ranges to send.
+//
+//   Returns:
+//     The number of ranges, 0 if none can be satisfied, or -1 if the whole
+//     file should be sent: there is no usable Range header, or an If-Range
+//     shows the client's partial copy is stale.
+static int chttp_file_ranges(chttp_request *req, chttp_file *f, chttp_range *ranges)
+{
+    const char *range = chttp_get_header(req->headers, "Range");
+    if (range == NULL || req->method != GET)
+        return -1;
+
+    const char *if_range = chttp_get_header(req->headers, "If-Range");
+    if (if_range != NULL)
     {
-        return 1;
+        time_t t;
+        if (if_range[0] == '"' || strncmp(if_range, "W/", 2) == 0)
+        {
+            if (!chttp_etag_match(if_range, f->etag, 0))
+                return -1;
+        } else if (chttp_parse_http_date(if_range, &t) || t != f->mtime)
+            return -1;
+    }
+
+    return chttp_parse_ranges(range, f->size, ranges, CHTTP_MAX_RANGES);
+}
+
+// chttp_queue_file
+//   Parameters:
+//     * c      - The connection.
+//     * f      - The file.
+//     * offset - Where to start.
+//     * len    - Number of bytes.
+//     * last   - Whether this is the last part of the file to be queued, after
+//                which the file is let go once sent.
+//
+//   Returns:
+//     -1 if the bytes could not be queued, in which case the file has been
+//     let go. 0 on success.
+static int chttp_queue_file(chttp_conn *c, chttp_file *f, size_t offset, size_t len, bool last)
+{
+    int r;
+    if (f->entry != NULL)
+        r = chttp_conn_write_ref(c, f->body + offset, len, last ? &chttp_cache_release : NULL, f->entry);
+    else
+        r = chttp_conn_sendfile(c, f->fd, offset, len, last);
+    if (r < 0)
+        chttp_file_release(f);
+    return r;
+}
+
+// chttp_send_file
+//   Parameters:
+//     * c   - The connection.
+//     * req - The request.
+//     * res - An empty response from the connection's arena.
+//     * f   - The file to send, let go of once sent.
+//
+//   Description:
+//     Answering a request for a file with 304 Not Modified if the client's
+//     copy is current, 206 Partial Content for satisfiable ranges, 416 if
+//     none are, or else 200 with the whole file. Several ranges go out as
+//     multipart/byteranges, each part taken straight from the cached bytes or
+//     the file with its own offset.
+//
+//   Returns:
+//     -1 if the connection should be dropped. 0 on success.
+static int chttp_send_file(chttp_conn *c, chttp_request *req, chttp_response *res, chttp_file *f)
+{
+    chttp_arena *arena = chttp_conn_arena(c);
+    chttp_header_set *h = res->headers;
+
+    chttp_range ranges[CHTTP_MAX_RANGES];
+    int nranges = -1;
+    if (chttp_not_modified(req, f))
+        res->code = 304;
+    else if ((nranges = chttp_file_ranges(req, f, ranges)) == 0)
+        res->code = 416;
+    else
+        res->code = nranges > 0 ? 206 : 200;
+
+    // One range needs no multipart wrapping.
+    if (nranges < 0)
+    {
+        nranges = 1;
+        ranges[0].start = 0;
+        ranges[0].len = f->size;
     }
+    bool multipart = res->code == 206 && nranges > 1;
+
+    char value[128];
+    char boundary[32];
+    char **parts = NULL;
+    size_t length = 0;
+    if (multipart)
+    {
+        static atomic_uint boundary_counter;
+        snprintf(boundary, sizeof(boundary), "chttp%08lx%08x", (unsigned long)time(NULL),
+                 atomic_fetch_add(&boundary_counter, 1));
+        snprintf(value, sizeof(value), "multipart/byteranges; boundary=%s", boundary);
+        chttp_add_header(h, "Content-Type", value);
 
+        parts = (char **)chttp_arena_alloc(arena, sizeof(char *) * (nranges + 1));
+        if (parts == NULL)
+        {
+            chttp_file_release(f);
+            return -1;
+        }
+        for (int i = 0; i <= nranges; i++)
+        {
+            parts[i] = (char *)chttp_arena_alloc(arena, 256);
+            if (parts[i] == NULL)
+            {
+                chttp_file_release(f);
+                return -1;
+            }
+            if (i == nranges)
+                sprintf(parts[i], "\r\n--%s--\r\n", boundary);
+            else
+                snprintf(parts[i], 256, "\r\n--%s\r\nContent-Type: %s\r\nContent-Range: bytes %zu-%zu/%zu\r\n\r\n",
+                         boundary, f->type ? f->type : "application/octet-stream", ranges[i].start,
+                         ranges[i].start + ranges[i].len - 1, f->size);
+            length += strlen(parts[i]) + (i < nranges ? ranges[i].len : 0);
+        }
+    } else if ((res->code == 200 || res->code == 206) && f->type != NULL)
+        chttp_add_header(h, "Content-Type", f->type);
+
+    if (f->gzip)
+        chttp_add_header(h, "Content-Encoding", "gzip");
+    if (res->code == 416)
+    {
+        snprintf(value, sizeof(value), "bytes */%zu", f->size);
+        chttp_add_header(h, "Content-Range", value);
+        chttp_add_header(h, "Content-Length", "0");
+    } else if (res->code != 304)
+    {
+        if (!multipart)
+            length = ranges[0].len;
+        snprintf(value, sizeof(value), "%zu", length);
+        chttp_add_header(h, "Content-Length", value);
+    }
+    if (res->code == 206 && !multipart)
+    {
+        snprintf(value, sizeof(value), "bytes %zu-%zu/%zu", ranges[0].start, ranges[0].start + ranges[0].len - 1,
+                 f->size);
+        chttp_add_header(h, "Content-Range", value);
+    }
+    if (!f->gzip)
+        chttp_add_header(h, "Accept-Ranges", "bytes");
+    chttp_add_header(h, "ETag", f->etag);
+    chttp_http_date(f->mtime, value, sizeof(value));
+    chttp_add_header(h, "Last-Modified", value);
+    if (chttp_type_compressible(f->type))
+        chttp_add_header(h, "Vary", "Accept-Encoding");
+    const char *connection = chttp_connection_value(chttp_conn_connection(c));
+    if (connection != NULL)
+        chttp_add_header(h, "Connection", connection);
+
+    // The head is queued as pointers into the response, which lives in the
+    // arena until it has been sent. Only the status line is formatted.
+    int iovcnt = chttp_response_iovcnt(res);
+    struct iovec iov[iovcnt];
+    char *status = (char *)chttp_arena_alloc(arena, CHTTP_STATUS_LINE_LENGTH);
+    if (status != NULL)
+        iovcnt = chttp_iov_response(res, NULL, 0, status, iov, iovcnt);
+    if (status == NULL || chttp_conn_writev(c, iov, iovcnt) < 0)
+    {
+        chttp_file_release(f);
+        return -1;
+    }
+
+    if (req->method == HEAD || res->code == 304 || res->code == 416 || f->size == 0)
+    {
+        chttp_file_release(f);
+        return 0;
+    }
+    if (!multipart)
+        return chttp_queue_file(c, f, ranges[0].start, ranges[0].len, true);
+
+    for (int i = 0; i < nranges; i++)
+    {
+        if (chttp_conn_write_ref(c, parts[i], strlen(parts[i]), NULL, NULL) < 0)
+        {
+            chttp_file_release(f);
+            return -1;
+        }
+        if (chttp_queue_file(c, f, ranges[i].start, ranges[i].len, i == nranges - 1))
+            return -1;
+    }
+    return chttp_conn_write_ref(c, parts[nranges], strlen(parts[nranges]), NULL, NULL);
+}
+
+// chttp_static_file
+//   Parameters:
+//     * ctx   - The chttp_conn the request arrived on.
+//     * req   - The parsed request.
+//     * match - A mount whose data is the document root and whose rest is the
+//               path of the file under it.
+//
+//   Description:
+//     Route handler sending a file back to a client with appropriate headers,
+//     or listing a directory.
+//
+//   Returns:
+//     -1 if the connection should be dropped. 0 on success.
+int chttp_static_file(void *ctx, chttp_request *req, const chttp_route_match *match)
+{
+    chttp_conn *c = (chttp_conn *)ctx;
+    chttp_arena *arena = chttp_conn_arena(c);
+
+    // Calculating the file's path under the document root. The path has been
+    // cleaned by chttp_respond, so it cannot leave the root.
+    const char *root = (const char *)match->data;
+    const char *path = match->rest_len ? match->rest : "/";
+    int path_len = match->rest_len ? (int)match->rest_len : 1;
+    bool directory = path[path_len - 1] == '/';
+    const int uri_length = strlen(root) + CHTTP_URI_LENGTH + 12;
+    char uri[uri_length];
+    sprintf(uri, "%s%.*s%s", root, path_len, path, directory ? "index.html" : "");
+
+    // Ranges are served from the file as it is on disk, never from a gzip
+    // encoding of it.
+    bool range = chttp_get_header(req->headers, "Range") != NULL && req->method == GET;
+    bool gzip = !range && chttp_accepts_gzip(chttp_get_header(req->headers, "Accept-Encoding"));
+    bool conditional = range || chttp_get_header(req->headers, "If-None-Match") != NULL ||
+        chttp_get_header(req->headers, "If-Modified-Since") != NULL;
+
+    chttp_file f;
+    memset(&f, 0, sizeof(f));
+    f.fd = -1;
+
+    // A cached file goes out as its pre-built head and body in one writev,
+    // gzip-encoded if the client takes that. Conditional and range requests
+    // need a head of their own.
+    chttp_cache_entry *e = chttp_cache_get(&chttp_file_cache, uri);
+    if (e != NULL)
+    {
+        chttp_cache_variant *v = gzip ? chttp_cache_gzip(&chttp_file_cache, e) : NULL;
+        f.gzip = v != NULL;
+        if (v == NULL)
+            v = &e->identity;
+
+        if (conditional)
+        {
+            f.entry = e;
+            f.body = v->body;
+            f.size = v->body_len;
+            f.type = e->type;
+            f.etag = v->etag;
+            f.mtime = e->mtime.tv_sec;
+            chttp_response *res = chttp_response_arena_allocate(arena);
+            if (res == NULL)
+            {
+                chttp_cache_release(e);
+                return -1;
+            }
+            return chttp_send_file(c, req, res, &f);
+        }
+
+        chttp_connection connection = chttp_conn_connection(c);
+        const char *head = v->head[connection];
+        size_t head_length = v->head_len[connection];
+        if (req->method == HEAD)
+        {
+            if (chttp_conn_write_ref(c, head, head_length, &chttp_cache_release, e) == 0)
+                return 0;
+        } else if (chttp_conn_write_ref(c, head, head_length, NULL, NULL) == 0 &&
+                   chttp_conn_write_ref(c, v->body, v->body_len, &chttp_cache_release, e) == 0)
+            return 0;
+
+        chttp_cache_release(e);
+        return -1;
+    }
+
+    // Creating a base response.
+    chttp_response *res = chttp_response_arena_allocate(arena);
+    if (res == NULL)
+        return -1;
+
+    // Files are not read here at all; only their metadata is needed for the
+    // head.
+    struct stat st;
+    int fd = open(uri, O_RDONLY | O_CLOEXEC);
+    if (fd >= 0 && (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)))
+    {
+        close(fd);
+        fd = -1;
+    }
+
+    // Listing a directory needs chunked encoding, which HTTP/1.0 lacks.
+    DIR *dir;
+    if (fd < 0 && chttp_autoindex && directory &&
+        strcmp(req->http_version, "HTTP/1.1") == 0)
+    {
+        uri[strlen(uri) - strlen("index.html")] = '\0';
+        if ((dir = opendir(uri)) != NULL)
+            return chttp_list_directory(c, req, res, dir);
+        strcat(uri, "index.html");
+    }
+
+    if (fd >= 0)
+    {
+        // Files too big for the cache are not compressed on the fly, but a
+        // pre-compressed sibling is sent in their place.
+        f.type = chttp_file_type(uri);
+        int gz = gzip && chttp_type_compressible(f.type) ? chttp_open_gzip_sibling(uri, &st) : -1;
+        if (gz >= 0)
+        {
+            close(fd);
+            fd = gz;
+            f.gzip = true;
+        }
+
+        char *etag = (char *)chttp_arena_alloc(arena, CHTTP_ETAG_LENGTH);
+        if (etag == NULL)
+        {
+            close(fd);
+            return -1;
+        }
+        chttp_file_etag(&st, etag, CHTTP_ETAG_LENGTH);
+        f.fd = fd;
+        f.size = st.st_size;
+        f.etag = etag;
+        f.mtime = st.st_mtim.tv_sec;
+        return chttp_send_file(c, req, res, &f);
+    }
+
+    res->code = 404;
+    res->body = (char *)chttp_arena_alloc(arena, uri_length + 32);
+    if (res->body == NULL)
+        return -1;
+    res->body_len = sprintf(res->body, "Error 404, file not found: %s\n", uri);
+
+    // Framing the body so the connection can carry another request after it.
+    char length[32];
+    sprintf(length, "%zu", res->body_len);
+    chttp_add_header(res->headers, "Content-Length", length);
+    const char *connection = chttp_connection_value(chttp_conn_connection(c));
+    if (connection != NULL)
+        chttp_add_header(res->headers, "Connection", connection);
+
+    const char *body = req->method != HEAD ? res->body : NULL;
+    int iovcnt = chttp_response_iovcnt(res);
+    struct iovec iov[iovcnt];
+    char *status = (char *)chttp_arena_alloc(arena, CHTTP_STATUS_LINE_LENGTH);
+    if (status != NULL)
+        iovcnt = chttp_iov_response(res, body, res->body_len, status, iov, iovcnt);
+    if (status == NULL || chttp_conn_writev(c, iov, iovcnt) < 0)
+        return -1;
     return 0;
 }
 
+// chttp_worker_run
+//   Parameters:
+//     * arg - The chttp_worker to run.
+//
+//   Description:
+//     Thread entry point running a worker's reactor, after optionally pinning
+//     the thread to a CPU.
+void *chttp_worker_run(void *arg)
+{
+    chttp_worker *w = (chttp_worker *)arg;
+
+    if (w->pin)
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(w->id % sysconf(_SC_NPROCESSORS_ONLN), &set);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set))
+            fprintf(stderr, "chttp_server: failed to pin worker %d.\n", w->id);
+    }
+
+    chttp_reactor_run(&w->reactor);
+    chttp_print_error(stderr, "Event loop failed.");
+    return NULL;
+}
+
 // main
 //   Parameters:
 //     * argc - Program-passed argument count.
@@ -343,31 +1078,109 @@ int main(int argc, char **argv)
         printf("  Address: %s\n", args.address);
         printf("  Port: %u\n", args.port);
         printf("  Backlog: %d\n", args.backlog);
+        printf("  Workers: %d\n", args.workers);
+        printf("  Pin: %d\n", args.pin);
+        printf("  Accept queue: %d\n", args.accept_queue);
+        printf("  Max connections: %d\n", args.max_connections);
+        printf("  Keep-alive timeout: %d\n", args.keepalive_timeout);
+        printf("  Max requests: %d\n", args.max_requests);
+        printf("  Gzip threads: %d\n", args.gzip_threads);
+        printf("  Cache size: %zu\n", args.cache_size);
+        printf("  Cache file max: %zu\n", args.cache_file_max);
+        printf("  Autoindex: %d\n", args.autoindex);
+        printf("  MIME types: %s\n", args.mime_types ? args.mime_types : "built-in");
         printf("  Help: %d\n", args.help);
         printf("  Verbose: %d\n", args.verbose);
     }
 
-    int sock;
-    if (chttp_create_server(args, &sock))
+    // Writes to clients that have gone away should fail, not kill us.
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGUSR1, &chttp_request_stats);
+
+    // Compressing a large file in parts on a pool of its own keeps the reactor
+    // that asked for it waiting for less time.
+    if (args.gzip_threads > 0 && chttp_sched_fill(&chttp_gzip_sched, args.gzip_threads, true))
     {
-        chttp_print_error(stderr, "Failed to create server.");
+        chttp_print_error(stderr, "Failed to start gzip threads.");
+        return 1;
+    }
+    chttp_cache_fill(&chttp_file_cache, args.cache_size, args.cache_file_max,
+                     args.gzip_threads > 0 ? &chttp_gzip_sched : NULL);
+    chttp_autoindex = args.autoindex;
+    if (args.mime_types != NULL && chttp_mime_load(args.mime_types))
+    {
+        chttp_print_error(stderr, "Failed to load MIME types.");
         return 1;
     }
 
-    chttp_client *cli;
-    while (1)
+    // Every path is served from the document root, unless a more specific
+    // route or mount is registered. Files are only read, so other methods get
+    // a 405 saying so, while HEAD is served by the GET mount.
+    if (chttp_router_fill(&chttp_routes) || chttp_router_mount(&chttp_routes, GET, "/", &chttp_static_file, "www"))
     {
-        cli = (chttp_client *)malloc(sizeof(chttp_client));
-        memset(cli, 0, sizeof(chttp_client));
+        chttp_print_error(stderr, "Failed to create routes.");
+        return 1;
+    }
 
-        cli->addr_size = sizeof(cli->addr);
-        cli->sock = accept(sock, (struct sockaddr *)&cli->addr, &cli->addr_size);
-        if (args.verbose)
-            printf("Accepted connection!\n");
-        chttp_handle_client(cli);
+    // With an accept queue the main thread only accepts, and every reactor
+    // takes its connections from the one ring.
+    int listener = -1;
+    chttp_ring *handoff = NULL;
+    if (args.accept_queue > 0)
+    {
+        handoff = (chttp_ring *)malloc(sizeof(chttp_ring));
+        if (handoff == NULL || chttp_ring_fill(handoff, args.accept_queue) || chttp_create_server(args, &listener))
+        {
+            chttp_print_error(stderr, "Failed to create server.");
+            return 1;
+        }
     }
 
-    printf("%s %d\n", args.address, args.port);
+    // Creating every listener up front so a bind failure is reported before
+    // any thread starts.
+    chttp_worker *workers = (chttp_worker *)calloc(args.workers, sizeof(chttp_worker));
+    chttp_reactor **reactors = (chttp_reactor **)calloc(args.workers, sizeof(chttp_reactor *));
+    for (int i = 0; i < args.workers; i++)
+    {
+        workers[i].id = i;
+        workers[i].pin = args.pin;
+        workers[i].sock = listener;
+        reactors[i] = &workers[i].reactor;
+        if (handoff == NULL && chttp_create_server(args, &workers[i].sock))
+        {
+            chttp_print_error(stderr, "Failed to create server.");
+            return 1;
+        }
 
-    return 0;
+        if (chttp_reactor_fill(&workers[i].reactor, workers[i].sock, handoff, &chttp_respond, &args))
+        {
+            chttp_print_error(stderr, "Failed to create event loop.");
+            return 1;
+        }
+    }
+    chttp_workers = workers;
+    chttp_worker_count = args.workers;
+
+    // The main thread runs the first reactor itself, unless it is the
+    // acceptor.
+    for (int i = handoff ? 0 : 1; i < args.workers; i++)
+    {
+        if (pthread_create(&workers[i].thread, NULL, &chttp_worker_run, &workers[i]))
+        {
+            chttp_print_error(stderr, "Failed to start worker.");
+            return 1;
+        }
+    }
+
+    if (handoff != NULL)
+    {
+        chttp_acceptor_run(listener, handoff, reactors, args.workers, &chttp_accept_shed);
+        chttp_print_error(stderr, "Accept loop failed.");
+        return 1;
+    }
+
+    workers[0].thread = pthread_self();
+    chttp_worker_run(&workers[0]);
+
+    return 1;
 }
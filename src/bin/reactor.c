@@ -0,0 +1,809 @@
+#include "server.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdio.h>
+#include <errno.h>
+#include <time.h>
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <unistd.h>
+
+// Reading the monotonic clock in seconds.
+static long reactor_clock()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec;
+}
+
+// Getting the monotonic time in milliseconds, for short back-offs.
+static long reactor_clock_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// Taking an arena from the reactor's spares, or making a new one.
+static chttp_arena *reactor_take_arena(chttp_reactor *r)
+{
+    if (r->spare_len > 0)
+        return r->spare[--r->spare_len];
+    return chttp_arena_allocate(CHTTP_ARENA_BLOCK_SIZE);
+}
+
+// Handing an arena back to the reactor for the next connection.
+static void reactor_give_arena(chttp_reactor *r, chttp_arena *a)
+{
+    if (r->spare_len < CHTTP_REACTOR_SPARE_ARENAS)
+    {
+        chttp_arena_reset(a);
+        r->spare[r->spare_len++] = a;
+    } else
+        chttp_arena_free(a);
+}
+
+// Unlinking a connection from the reactor's activity list.
+static void conn_unlink(chttp_conn *c)
+{
+    chttp_reactor *r = c->reactor;
+    if (c->prev != NULL)
+        c->prev->next = c->next;
+    else
+        r->oldest = c->next;
+    if (c->next != NULL)
+        c->next->prev = c->prev;
+    else
+        r->newest = c->prev;
+    c->prev = c->next = NULL;
+}
+
+// Marking a connection as just active by moving it to the end of the list.
+static void conn_touch(chttp_conn *c)
+{
+    chttp_reactor *r = c->reactor;
+    c->last_active = r->now;
+    if (r->newest == c)
+        return;
+
+    if (c->prev != NULL || c->next != NULL || r->oldest == c)
+        conn_unlink(c);
+    c->prev = r->newest;
+    c->next = NULL;
+    if (r->newest != NULL)
+        r->newest->next = c;
+    else
+        r->oldest = c;
+    r->newest = c;
+}
+
+// Letting go of whatever a finished or abandoned queue entry holds on to.
+static void write_done(chttp_write *w)
+{
+    if (w->close_fd)
+        close(w->fd);
+    if (w->release != NULL)
+        w->release(w->release_arg);
+}
+
+// Closing a connection and releasing everything attached to it.
+static void conn_close(chttp_conn *c)
+{
+    chttp_reactor *r = c->reactor;
+    if (r->verbose)
+        printf("Closed connection %d after %d requests.\n", c->sock, c->requests);
+
+    conn_unlink(c);
+    close(c->sock);
+    for (chttp_write *w = c->out; w != NULL; w = w->next)
+        write_done(w);
+    if (c->arena != NULL)
+        reactor_give_arena(r, c->arena);
+    r->connections--;
+
+    // Events for the connection may still follow in the batch being handled,
+    // so it is only marked dead here and recycled once the batch is done.
+    c->sock = -1;
+    c->next = r->closed;
+    r->closed = c;
+}
+
+// Moving the connections closed during a batch of events to the spares.
+static void reactor_reap(chttp_reactor *r)
+{
+    while (r->closed != NULL)
+    {
+        chttp_conn *c = r->closed;
+        r->closed = c->next;
+        if (r->spare_conns_len < CHTTP_REACTOR_SPARE_CONNS)
+        {
+            c->next = r->spare_conns;
+            r->spare_conns = c;
+            r->spare_conns_len++;
+        } else
+            free(c);
+    }
+}
+
+// Taking a zeroed connection from the reactor's spares, or making a new one.
+static chttp_conn *reactor_take_conn(chttp_reactor *r)
+{
+    chttp_conn *c = r->spare_conns;
+    if (c == NULL)
+        return (chttp_conn *)calloc(1, sizeof(chttp_conn));
+
+    r->spare_conns = c->next;
+    r->spare_conns_len--;
+    memset(c, 0, sizeof(chttp_conn));
+    return c;
+}
+
+// Attaching an arena and input buffer to a connection that has data to read.
+static int conn_attach(chttp_conn *c)
+{
+    if (c->arena != NULL)
+        return 0;
+
+    c->arena = reactor_take_arena(c->reactor);
+    if (c->arena == NULL)
+        return -1;
+
+    c->in = (char *)chttp_arena_alloc(c->arena, CHTTP_CONN_BUFFER_LENGTH);
+    c->in_off = 0;
+    c->in_len = 0;
+    c->out = c->out_tail = NULL;
+    c->out_bytes = 0;
+    chttp_parser_init(&c->parser);
+    return c->in ? 0 : -1;
+}
+
+// Releasing per-request memory once every response has been sent. An idle
+// connection gives its arena back to the reactor; one with the start of a
+// pipelined request buffered keeps those bytes and resets the rest. Returns
+// -1 if the connection should be dropped.
+static int conn_recycle(chttp_conn *c)
+{
+    if (c->arena == NULL || c->out != NULL)
+        return 0;
+
+    size_t pending = c->in_len - c->in_off;
+    if (pending == 0)
+    {
+        reactor_give_arena(c->reactor, c->arena);
+        c->arena = NULL;
+        c->in = NULL;
+        return 0;
+    }
+
+    // Resetting keeps the arena's blocks and allocating writes nothing, so the
+    // old bytes are intact until moved. The new buffer is usually the old one,
+    // being the first allocation in both cases, hence memmove.
+    const char *old = c->in + c->in_off;
+    chttp_arena_reset(c->arena);
+    c->in = (char *)chttp_arena_alloc(c->arena, CHTTP_CONN_BUFFER_LENGTH);
+    if (c->in == NULL)
+        return -1;
+    memmove(c->in, old, pending);
+    c->in_off = 0;
+    c->in_len = pending;
+    return 0;
+}
+
+// Appending an entry to a connection's write queue.
+static void conn_enqueue(chttp_conn *c, chttp_write *w)
+{
+    w->next = NULL;
+    if (c->out_tail != NULL)
+        c->out_tail->next = w;
+    else
+        c->out = w;
+    c->out_tail = w;
+    c->out_bytes += w->len;
+}
+
+// Allocating a queue entry for len bytes of memory.
+static chttp_write *conn_memory_write(chttp_conn *c, size_t extra)
+{
+    chttp_write *w = (chttp_write *)chttp_arena_alloc(c->arena, sizeof(chttp_write) + extra);
+    if (w == NULL)
+        return NULL;
+
+    w->iov = NULL;
+    w->iovcnt = 0;
+    w->off = 0;
+    w->fd = -1;
+    w->close_fd = false;
+    w->release = NULL;
+    w->release_arg = NULL;
+    return w;
+}
+
+// Queueing bytes on a connection.
+int chttp_conn_write(chttp_conn *c, const char *data, size_t len)
+{
+    chttp_write *w = conn_memory_write(c, len);
+    if (w == NULL)
+        return -1;
+
+    char *copy = (char *)(w + 1);
+    memcpy(copy, data, len);
+    w->data = copy;
+    w->len = len;
+    conn_enqueue(c, w);
+    return 0;
+}
+
+// Queueing bytes on a connection without copying them.
+int chttp_conn_write_ref(chttp_conn *c, const char *data, size_t len, chttp_release release, void *arg)
+{
+    chttp_write *w = conn_memory_write(c, 0);
+    if (w == NULL)
+        return -1;
+
+    w->data = data;
+    w->len = len;
+    w->release = release;
+    w->release_arg = arg;
+    conn_enqueue(c, w);
+    return 0;
+}
+
+// Queueing a list of buffers on a connection without copying them.
+int chttp_conn_writev(chttp_conn *c, const struct iovec *iov, int iovcnt)
+{
+    chttp_write *w = conn_memory_write(c, sizeof(struct iovec) * iovcnt);
+    if (w == NULL)
+        return -1;
+
+    struct iovec *copy = (struct iovec *)(w + 1);
+    memcpy(copy, iov, sizeof(struct iovec) * iovcnt);
+    w->data = NULL;
+    w->iov = copy;
+    w->iovcnt = iovcnt;
+    w->len = 0;
+    for (int i = 0; i < iovcnt; i++)
+        w->len += iov[i].iov_len;
+    conn_enqueue(c, w);
+    return 0;
+}
+
+// Queueing part of a file on a connection.
+int chttp_conn_sendfile(chttp_conn *c, int fd, off_t offset, size_t len, bool close_fd)
+{
+    chttp_write *w = conn_memory_write(c, 0);
+    if (w == NULL)
+        return -1;
+
+    w->data = NULL;
+    w->len = len;
+    w->fd = fd;
+    w->file_off = offset;
+    w->close_fd = close_fd;
+    conn_enqueue(c, w);
+    return 0;
+}
+
+// Reporting whether a connection outlives its current request.
+bool chttp_conn_keep_alive(chttp_conn *c)
+{
+    return c->keep_alive;
+}
+
+// Reporting what the current response says about the connection.
+chttp_connection chttp_conn_connection(chttp_conn *c)
+{
+    return c->connection;
+}
+
+// Getting the Connection header value for a response.
+const char *chttp_connection_value(chttp_connection connection)
+{
+    if (connection == CHTTP_CONNECTION_CLOSE)
+        return "close";
+    if (connection == CHTTP_CONNECTION_KEEP_ALIVE)
+        return "keep-alive";
+    return NULL;
+}
+
+// Getting a connection's arena.
+chttp_arena *chttp_conn_arena(chttp_conn *c)
+{
+    return c->arena;
+}
+
+// Adding the unsent part of a memory entry to iov, as far as it has room.
+// Returns the new number of iovecs.
+static int write_gather(chttp_write *w, struct iovec *iov, int iovcnt)
+{
+    if (w->iov == NULL)
+    {
+        iov[iovcnt].iov_base = (void *)(w->data + w->off);
+        iov[iovcnt].iov_len = w->len - w->off;
+        return iovcnt + 1;
+    }
+
+    size_t skip = w->off;
+    for (int i = 0; i < w->iovcnt && iovcnt < CHTTP_CONN_IOVECS; i++)
+    {
+        if (skip >= w->iov[i].iov_len)
+        {
+            skip -= w->iov[i].iov_len;
+            continue;
+        }
+        iov[iovcnt].iov_base = (char *)w->iov[i].iov_base + skip;
+        iov[iovcnt].iov_len = w->iov[i].iov_len - skip;
+        iovcnt++;
+        skip = 0;
+    }
+    return iovcnt;
+}
+
+// Writing as much of the queue as the socket accepts. Returns 1 once the
+// queue is empty, 0 if the socket is full and -1 on error.
+static int conn_flush(chttp_conn *c)
+{
+    while (c->out != NULL)
+    {
+        ssize_t n;
+        chttp_write *w = c->out;
+        if (w->fd < 0)
+        {
+            // Gathering the run of memory entries at the front of the queue
+            // into one writev.
+            struct iovec iov[CHTTP_CONN_IOVECS];
+            int iovcnt = 0;
+            for (chttp_write *m = w; m != NULL && m->fd < 0 && iovcnt < CHTTP_CONN_IOVECS; m = m->next)
+                iovcnt = write_gather(m, iov, iovcnt);
+            n = writev(c->sock, iov, iovcnt);
+        } else if (w->len > w->off)
+            n = sendfile(c->sock, w->fd, &w->file_off, w->len - w->off);
+        else
+            n = 0;
+
+        if (n < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return 0;
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+
+        // A file that shrank since it was queued can never be finished, and
+        // the client has been promised its original length.
+        if (n == 0 && w->len > w->off)
+            return -1;
+
+        conn_touch(c);
+        c->out_bytes -= n;
+        while (c->out != NULL)
+        {
+            w = c->out;
+            size_t left = w->len - w->off;
+            if ((size_t)n < left)
+            {
+                w->off += n;
+                break;
+            }
+
+            n -= left;
+            w->off = w->len;
+            write_done(w);
+            c->out = w->next;
+            if (c->out == NULL)
+                c->out_tail = NULL;
+            if (n == 0 && (c->out == NULL || c->out->len > 0))
+                break;
+        }
+    }
+
+    return 1;
+}
+
+// Queueing a copy of some buffers and sending what the socket takes now.
+int chttp_conn_sink(void *arg, const struct iovec *iov, int iovcnt)
+{
+    chttp_conn *c = (chttp_conn *)arg;
+
+    size_t len = 0;
+    for (int i = 0; i < iovcnt; i++)
+        len += iov[i].iov_len;
+
+    chttp_write *w = conn_memory_write(c, len);
+    if (w == NULL)
+        return -1;
+
+    char *copy = (char *)(w + 1);
+    w->data = copy;
+    w->len = len;
+    for (int i = 0; i < iovcnt; i++)
+    {
+        memcpy(copy, iov[i].iov_base, iov[i].iov_len);
+        copy += iov[i].iov_len;
+    }
+    conn_enqueue(c, w);
+    return conn_flush(c) < 0 ? -1 : 0;
+}
+
+// Queueing a canned error response and marking the connection for closing.
+// Both pieces are static, so nothing is formatted or copied.
+static void conn_fail(chttp_conn *c, int code)
+{
+    static const char tail[] = "Content-Length: 0\r\nConnection: close\r\n\r\n";
+    struct iovec iov[2];
+    iov[0].iov_base = (void *)chttp_status_line(code, &iov[0].iov_len);
+    iov[1].iov_base = (void *)tail;
+    iov[1].iov_len = sizeof(tail) - 1;
+    chttp_conn_writev(c, iov, 2);
+    c->closing = true;
+}
+
+// Checking whether a comma-separated Connection header lists a token.
+static bool connection_has(const char *value, const char *token)
+{
+    size_t len = strlen(token);
+    while (value != NULL && *value)
+    {
+        while (*value == ' ' || *value == '\t' || *value == ',')
+            value++;
+        if (strncasecmp(value, token, len) == 0 &&
+            (value[len] == '\0' || value[len] == ',' || value[len] == ' ' || value[len] == '\t'))
+            return true;
+        value = strchr(value, ',');
+    }
+    return false;
+}
+
+// Deciding whether the connection may stay open after this request. HTTP/1.1
+// is persistent unless the client says otherwise; HTTP/1.0 only on request.
+static bool request_keep_alive(chttp_request *req)
+{
+    char *connection = chttp_get_header(req->headers, "Connection");
+    if (strcmp(req->http_version, "HTTP/1.1") == 0)
+        return !connection_has(connection, "close");
+    return connection_has(connection, "keep-alive");
+}
+
+// Handing a complete request to the handler and moving past it in the input
+// buffer.
+static int conn_dispatch(chttp_conn *c)
+{
+    chttp_reactor *r = c->reactor;
+    char *buf = c->in + c->in_off;
+    c->in_off += chttp_parser_message_length(&c->parser);
+    c->requests++;
+
+    chttp_request *req = chttp_request_arena_allocate(c->arena);
+    if (req == NULL || chttp_request_from_view(req, &c->parser.view, buf))
+    {
+        conn_fail(c, 400);
+        return 0;
+    }
+
+    c->keep_alive = request_keep_alive(req) &&
+        (r->max_requests == 0 || c->requests < r->max_requests);
+    if (!c->keep_alive)
+    {
+        c->connection = CHTTP_CONNECTION_CLOSE;
+        c->closing = true;
+    } else if (strcmp(req->http_version, "HTTP/1.1") != 0)
+        c->connection = CHTTP_CONNECTION_KEEP_ALIVE;
+    else
+        c->connection = CHTTP_CONNECTION_DEFAULT;
+
+    chttp_parser_init(&c->parser);
+    return r->handler(c, req);
+}
+
+// Parsing and dispatching every complete request already buffered, in order.
+// Stops early once enough output is queued that the client should read some
+// of it first. Returns -1 if the connection should be dropped.
+static int conn_process(chttp_conn *c)
+{
+    while (!c->closing && c->out_bytes < CHTTP_CONN_OUT_HIGHWATER && c->in_off < c->in_len)
+    {
+        chttp_parser_status status = chttp_parser_execute(&c->parser, c->in + c->in_off, c->in_len - c->in_off);
+        if (status == CHTTP_PARSER_ERROR)
+            conn_fail(c, 400);
+        else if (status == CHTTP_PARSER_MESSAGE_COMPLETE)
+        {
+            if (conn_dispatch(c))
+                return -1;
+        } else
+            break;
+    }
+
+    return 0;
+}
+
+// Reading everything available on a connection, processing requests as they
+// complete. Returns -1 if the connection should be dropped.
+static int conn_read(chttp_conn *c)
+{
+    if (conn_attach(c))
+        return -1;
+
+    while (!c->closing && c->out_bytes < CHTTP_CONN_OUT_HIGHWATER)
+    {
+        if (conn_process(c))
+            return -1;
+        if (c->closing || c->out_bytes >= CHTTP_CONN_OUT_HIGHWATER)
+            break;
+
+        // Moving a partial request to the front of the buffer once it
+        // reaches the end.
+        if (c->in_len == CHTTP_CONN_BUFFER_LENGTH)
+        {
+            if (c->in_off == 0)
+            {
+                conn_fail(c, 413);
+                break;
+            }
+            memmove(c->in, c->in + c->in_off, c->in_len - c->in_off);
+            c->in_len -= c->in_off;
+            c->in_off = 0;
+        }
+
+        ssize_t n = recv(c->sock, c->in + c->in_len, CHTTP_CONN_BUFFER_LENGTH - c->in_len, 0);
+        if (n == 0)
+        {
+            // The client is done sending. Answer what it already asked for,
+            // then close.
+            c->closing = true;
+            break;
+        }
+        if (n < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+
+        conn_touch(c);
+        c->in_len += n;
+    }
+
+    return 0;
+}
+
+// Driving a connection after epoll reports events on it. Reading pauses while
+// too much output is queued, so draining the queue may let more requests be
+// processed.
+static void conn_event(chttp_conn *c, uint32_t events)
+{
+    if (events & (EPOLLERR | EPOLLHUP))
+    {
+        conn_close(c);
+        return;
+    }
+
+    while (1)
+    {
+        bool paused = false;
+        if (!c->closing)
+        {
+            if (conn_read(c))
+            {
+                conn_close(c);
+                return;
+            }
+            paused = c->out_bytes >= CHTTP_CONN_OUT_HIGHWATER;
+        }
+
+        int r = conn_flush(c);
+        if (r < 0 || (r > 0 && c->closing))
+        {
+            conn_close(c);
+            return;
+        }
+        if (r == 0)
+            return;
+
+        if (conn_recycle(c))
+        {
+            conn_close(c);
+            return;
+        }
+        if (!paused)
+            return;
+    }
+}
+
+// Closing connections that have been idle for longer than the timeout.
+static void reactor_expire(chttp_reactor *r)
+{
+    while (r->oldest != NULL && r->now - r->oldest->last_active >= r->keepalive_timeout)
+        conn_close(r->oldest);
+}
+
+// Taking on an accepted socket, or shedding it if the reactor is full.
+static void reactor_adopt(chttp_reactor *r, int sock)
+{
+    if (r->max_connections > 0 && r->connections >= r->max_connections)
+    {
+        atomic_fetch_add_explicit(&r->shed, 1, memory_order_relaxed);
+        chttp_shed(sock);
+        return;
+    }
+
+    chttp_conn *c = reactor_take_conn(r);
+    if (c == NULL)
+    {
+        close(sock);
+        return;
+    }
+    c->sock = sock;
+    c->reactor = r;
+
+    // Registering for both directions once, edge-triggered, so the
+    // connection never needs an epoll_ctl again.
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    ev.data.ptr = c;
+    if (epoll_ctl(r->epfd, EPOLL_CTL_ADD, sock, &ev) < 0)
+    {
+        close(sock);
+        free(c);
+        return;
+    }
+
+    r->connections++;
+    conn_touch(c);
+    if (r->verbose)
+        printf("Accepted connection %d.\n", sock);
+}
+
+// Accepting every pending connection on the listener.
+static void reactor_accept(chttp_reactor *r)
+{
+    while (1)
+    {
+        int sock = accept4(r->listener, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (sock < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+
+            // Out of descriptors or memory: the backlog keeps the connections,
+            // but the edge that announced them is gone, so the listener is
+            // re-armed once some may have been closed.
+            if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM)
+                r->accept_retry = reactor_clock_ms() + CHTTP_REACTOR_ACCEPT_BACKOFF;
+            return;
+        }
+
+        int opt = 1;
+        setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+        reactor_adopt(r, sock);
+    }
+}
+
+// Re-arming the listener after a back-off, which reports it again if
+// connections are still waiting. Returns the milliseconds left to wait.
+static int reactor_rearm(chttp_reactor *r)
+{
+    long left = r->accept_retry - reactor_clock_ms();
+    if (left > 0)
+        return left;
+
+    r->accept_retry = 0;
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.ptr = r;
+    epoll_ctl(r->epfd, EPOLL_CTL_MOD, r->listener, &ev);
+    return -1;
+}
+
+// Taking one socket off the handoff ring for every wake-up since the last.
+static void reactor_receive(chttp_reactor *r)
+{
+    uint64_t wakes;
+    if (read(r->wakefd, &wakes, sizeof(wakes)) != sizeof(wakes))
+        return;
+
+    int sock;
+    while (wakes-- > 0 && chttp_ring_pop(r->handoff, &sock))
+        reactor_adopt(r, sock);
+}
+
+// Waking a reactor up to take a socket off its ring.
+void chttp_reactor_wake(chttp_reactor *r)
+{
+    uint64_t one = 1;
+    if (write(r->wakefd, &one, sizeof(one)) < 0)
+        return;
+}
+
+// Filling a reactor.
+int chttp_reactor_fill(chttp_reactor *r, int listener, chttp_ring *handoff, chttp_handler handler,
+                       const chttp_server_args *args)
+{
+    memset(r, 0, sizeof(chttp_reactor));
+    r->listener = listener;
+    r->handoff = handoff;
+    r->wakefd = -1;
+    r->handler = handler;
+    r->verbose = args->verbose;
+    r->keepalive_timeout = args->keepalive_timeout;
+    r->max_requests = args->max_requests;
+    r->max_connections = args->max_connections;
+    r->now = reactor_clock();
+
+    r->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (r->epfd < 0)
+        return -1;
+
+    // The listener, or the eventfd standing in for it, is the only
+    // registration whose data.ptr is the reactor itself.
+    int fd = listener;
+    if (handoff != NULL && (fd = r->wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0)
+    {
+        close(r->epfd);
+        return -1;
+    }
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.ptr = r;
+    if (epoll_ctl(r->epfd, EPOLL_CTL_ADD, fd, &ev) < 0)
+    {
+        if (r->wakefd >= 0)
+            close(r->wakefd);
+        close(r->epfd);
+        return -1;
+    }
+
+    return 0;
+}
+
+// Running a reactor.
+int chttp_reactor_run(chttp_reactor *r)
+{
+    struct epoll_event events[CHTTP_REACTOR_EVENTS];
+    while (1)
+    {
+        // Waking up once a second to expire idle connections, but only while
+        // there are any, and sooner to retry accepting after running out of
+        // descriptors.
+        int timeout = r->oldest ? 1000 : -1;
+        int retry = r->accept_retry ? reactor_rearm(r) : -1;
+        if (retry >= 0 && (timeout < 0 || retry < timeout))
+            timeout = retry;
+        int n = epoll_wait(r->epfd, events, CHTTP_REACTOR_EVENTS, timeout);
+        if (n < 0 && errno != EINTR)
+            return -1;
+
+        r->now = reactor_clock();
+        if (chttp_stats_requested)
+        {
+            chttp_stats_requested = 0;
+            chttp_server_print_stats(stdout);
+        }
+
+        for (int i = 0; i < n; i++)
+        {
+            chttp_conn *c = (chttp_conn *)events[i].data.ptr;
+            if (events[i].data.ptr == r)
+            {
+                if (r->handoff != NULL)
+                    reactor_receive(r);
+                else
+                    reactor_accept(r);
+            } else if (c->sock >= 0)
+                conn_event(c, events[i].events);
+        }
+
+        reactor_expire(r);
+        reactor_reap(r);
+    }
+}
@@ -0,0 +1,81 @@
+#include "server.h"
+
+#include <stdlib.h>
+
+// Filling a ring.
+int chttp_ring_fill(chttp_ring *ring, size_t capacity)
+{
+    size_t size = 2;
+    while (size < capacity)
+        size *= 2;
+
+    ring->cells = (chttp_ring_cell *)malloc(sizeof(chttp_ring_cell) * size);
+    if (ring->cells == NULL)
+        return -1;
+    for (size_t i = 0; i < size; i++)
+        atomic_init(&ring->cells[i].seq, i);
+    ring->mask = size - 1;
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    return 0;
+}
+
+// Queueing a socket on a ring.
+bool chttp_ring_push(chttp_ring *ring, int sock)
+{
+    size_t pos = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    while (1)
+    {
+        chttp_ring_cell *cell = &ring->cells[pos & ring->mask];
+        size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+        if (diff == 0)
+        {
+            // The cell is free in this lap; claiming the position makes it
+            // ours. A failed exchange reloads pos.
+            if (atomic_compare_exchange_weak_explicit(&ring->head, &pos, pos + 1, memory_order_relaxed,
+                                                      memory_order_relaxed))
+            {
+                cell->sock = sock;
+                atomic_store_explicit(&cell->seq, pos + 1, memory_order_release);
+                return true;
+            }
+        } else if (diff < 0)
+            return false; // Still holding a socket from the previous lap.
+        else
+            pos = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    }
+}
+
+// Taking a socket off a ring.
+bool chttp_ring_pop(chttp_ring *ring, int *sock)
+{
+    size_t pos = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    while (1)
+    {
+        chttp_ring_cell *cell = &ring->cells[pos & ring->mask];
+        size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+        if (diff == 0)
+        {
+            if (atomic_compare_exchange_weak_explicit(&ring->tail, &pos, pos + 1, memory_order_relaxed,
+                                                      memory_order_relaxed))
+            {
+                *sock = cell->sock;
+                // Handing the cell to the producer one lap ahead.
+                atomic_store_explicit(&cell->seq, pos + ring->mask + 1, memory_order_release);
+                return true;
+            }
+        } else if (diff < 0)
+            return false; // Not written yet in this lap.
+        else
+            pos = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    }
+}
+
+// Freeing a ring.
+void chttp_ring_free(chttp_ring *ring)
+{
+    free(ring->cells);
+    ring->cells = NULL;
+}
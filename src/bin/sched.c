@@ -0,0 +1,324 @@
+#include "server.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+
+// The worker the calling thread is, if any.
+static _Thread_local chttp_sched_worker *sched_self;
+
+// Pushing a task on the bottom of the owner's deque.
+int chttp_deque_push(chttp_deque *d, chttp_task *t)
+{
+    long b = atomic_load_explicit(&d->bottom, memory_order_relaxed);
+    long top = atomic_load_explicit(&d->top, memory_order_acquire);
+    if (b - top >= CHTTP_DEQUE_LENGTH)
+        return -1;
+
+    atomic_store_explicit(&d->tasks[b % CHTTP_DEQUE_LENGTH], t, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+    return 0;
+}
+
+// Taking the most recently pushed task off the owner's deque.
+chttp_task *chttp_deque_take(chttp_deque *d)
+{
+    // Claiming the bottom slot first, so a thief that has not yet read bottom
+    // cannot take it as well.
+    long b = atomic_load_explicit(&d->bottom, memory_order_relaxed) - 1;
+    atomic_store_explicit(&d->bottom, b, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    long top = atomic_load_explicit(&d->top, memory_order_relaxed);
+
+    if (top > b)
+    {
+        atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+        return NULL;
+    }
+
+    chttp_task *t = atomic_load_explicit(&d->tasks[b % CHTTP_DEQUE_LENGTH], memory_order_relaxed);
+    if (top == b)
+    {
+        // The last task: the owner and a thief race for it on top.
+        if (!atomic_compare_exchange_strong_explicit(&d->top, &top, top + 1, memory_order_seq_cst,
+                                                     memory_order_relaxed))
+            t = NULL;
+        atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+    }
+    return t;
+}
+
+// Stealing the oldest task off another worker's deque.
+chttp_task *chttp_deque_steal(chttp_deque *d)
+{
+    long top = atomic_load_explicit(&d->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    long b = atomic_load_explicit(&d->bottom, memory_order_acquire);
+    if (top >= b)
+        return NULL;
+
+    chttp_task *t = atomic_load_explicit(&d->tasks[top % CHTTP_DEQUE_LENGTH], memory_order_relaxed);
+    if (!atomic_compare_exchange_strong_explicit(&d->top, &top, top + 1, memory_order_seq_cst,
+                                                 memory_order_relaxed))
+        return NULL;
+    return t;
+}
+
+// Whether a deque looks non-empty.
+static bool deque_busy(chttp_deque *d)
+{
+    return atomic_load_explicit(&d->bottom, memory_order_seq_cst) >
+           atomic_load_explicit(&d->top, memory_order_seq_cst);
+}
+
+// Appending a task to the shared queue. Needs the lock.
+static int shared_push(chttp_sched *s, chttp_task *t)
+{
+    if (s->shared_len == s->shared_cap)
+    {
+        size_t cap = s->shared_cap ? s->shared_cap * 2 : 256;
+        chttp_task **shared = (chttp_task **)malloc(sizeof(chttp_task *) * cap);
+        if (shared == NULL)
+            return -1;
+        for (size_t i = 0; i < s->shared_len; i++)
+            shared[i] = s->shared[(s->shared_head + i) % s->shared_cap];
+        free(s->shared);
+        s->shared = shared;
+        s->shared_head = 0;
+        s->shared_cap = cap;
+    }
+
+    s->shared[(s->shared_head + s->shared_len) % s->shared_cap] = t;
+    s->shared_len++;
+    atomic_store_explicit(&s->shared_count, s->shared_len, memory_order_relaxed);
+    return 0;
+}
+
+// Taking the oldest task off the shared queue. Needs the lock.
+static chttp_task *shared_pop(chttp_sched *s)
+{
+    if (s->shared_len == 0)
+        return NULL;
+
+    chttp_task *t = s->shared[s->shared_head];
+    s->shared_head = (s->shared_head + 1) % s->shared_cap;
+    s->shared_len--;
+    atomic_store_explicit(&s->shared_count, s->shared_len, memory_order_relaxed);
+    return t;
+}
+
+// Finding a task for a worker: its own newest, then the oldest shared one,
+// then one stolen from a victim picked at random.
+static chttp_task *sched_find(chttp_sched *s, chttp_sched_worker *w)
+{
+    chttp_task *t;
+    if (s->stealing && (t = chttp_deque_take(&w->deque)) != NULL)
+        return t;
+
+    if (atomic_load_explicit(&s->shared_count, memory_order_relaxed) > 0)
+    {
+        pthread_mutex_lock(&s->lock);
+        t = shared_pop(s);
+        pthread_mutex_unlock(&s->lock);
+        if (t != NULL)
+            return t;
+    }
+
+    if (!s->stealing || s->count < 2)
+        return NULL;
+    int start = rand_r(&w->seed) % s->count;
+    for (int i = 0; i < s->count; i++)
+    {
+        chttp_sched_worker *victim = &s->workers[(start + i) % s->count];
+        if (victim != w && (t = chttp_deque_steal(&victim->deque)) != NULL)
+        {
+            w->steals++;
+            return t;
+        }
+    }
+    return NULL;
+}
+
+// Running a task and counting it out of its group, waking the threads
+// outside the pool that wait for groups if it was the group's last.
+static void sched_run(chttp_sched *s, chttp_task *t)
+{
+    // The task may be gone once it has run, and the group once it is done,
+    // so only the scheduler is looked at afterwards.
+    chttp_task_group *g = t->group;
+    t->run(t);
+    if (g != NULL && atomic_fetch_sub_explicit(&g->pending, 1, memory_order_seq_cst) == 1 &&
+        atomic_load_explicit(&s->waiting, memory_order_seq_cst) > 0)
+    {
+        pthread_mutex_lock(&s->lock);
+        pthread_cond_broadcast(&s->done);
+        pthread_mutex_unlock(&s->lock);
+    }
+}
+
+// Whether any task is queued anywhere. Needs the lock.
+static bool sched_busy(chttp_sched *s)
+{
+    if (s->shared_len > 0)
+        return true;
+    for (int i = 0; s->stealing && i < s->count; i++)
+        if (deque_busy(&s->workers[i].deque))
+            return true;
+    return false;
+}
+
+// Running tasks until the scheduler stops.
+static void *sched_worker_run(void *arg)
+{
+    chttp_sched_worker *w = (chttp_sched_worker *)arg;
+    chttp_sched *s = w->sched;
+    sched_self = w;
+
+    int idle = 0;
+    while (1)
+    {
+        chttp_task *t = sched_find(s, w);
+        if (t != NULL)
+        {
+            sched_run(s, t);
+            idle = 0;
+            continue;
+        }
+
+        // Spinning briefly before sleeping, since a subtask is often only a
+        // moment away.
+        if (++idle < 64)
+        {
+            sched_yield();
+            continue;
+        }
+
+        // Announcing the sleep before the last look at the queues: a spawner
+        // either sees the announcement and signals, or its task is seen here.
+        pthread_mutex_lock(&s->lock);
+        atomic_fetch_add_explicit(&s->sleeping, 1, memory_order_seq_cst);
+        if (!sched_busy(s))
+        {
+            if (s->stopping)
+            {
+                atomic_fetch_sub_explicit(&s->sleeping, 1, memory_order_relaxed);
+                pthread_mutex_unlock(&s->lock);
+                return NULL;
+            }
+            pthread_cond_wait(&s->wake, &s->lock);
+        }
+        atomic_fetch_sub_explicit(&s->sleeping, 1, memory_order_relaxed);
+        pthread_mutex_unlock(&s->lock);
+        idle = 0;
+    }
+}
+
+// Filling a scheduler.
+int chttp_sched_fill(chttp_sched *s, int count, bool stealing)
+{
+    memset(s, 0, sizeof(chttp_sched));
+    s->count = count;
+    s->stealing = stealing;
+    pthread_mutex_init(&s->lock, NULL);
+    pthread_cond_init(&s->wake, NULL);
+    pthread_cond_init(&s->done, NULL);
+
+    s->workers = (chttp_sched_worker *)aligned_alloc(64, sizeof(chttp_sched_worker) * count);
+    if (s->workers == NULL)
+        return -1;
+    memset(s->workers, 0, sizeof(chttp_sched_worker) * count);
+
+    for (int i = 0; i < count; i++)
+    {
+        chttp_sched_worker *w = &s->workers[i];
+        w->sched = s;
+        w->id = i;
+        w->seed = i + 1;
+        if (pthread_create(&w->thread, NULL, &sched_worker_run, w))
+        {
+            s->count = i;
+            chttp_sched_stop(s);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Spawning a task.
+int chttp_sched_spawn(chttp_sched *s, chttp_task *t)
+{
+    if (t->group != NULL)
+        atomic_fetch_add_explicit(&t->group->pending, 1, memory_order_relaxed);
+
+    chttp_sched_worker *w = sched_self;
+    if (s->stealing && w != NULL && w->sched == s && chttp_deque_push(&w->deque, t) == 0)
+    {
+        atomic_thread_fence(memory_order_seq_cst);
+        if (atomic_load_explicit(&s->sleeping, memory_order_relaxed) > 0)
+        {
+            pthread_mutex_lock(&s->lock);
+            pthread_cond_signal(&s->wake);
+            pthread_mutex_unlock(&s->lock);
+        }
+        return 0;
+    }
+
+    pthread_mutex_lock(&s->lock);
+    if (shared_push(s, t))
+    {
+        pthread_mutex_unlock(&s->lock);
+        if (t->group != NULL)
+            atomic_fetch_sub_explicit(&t->group->pending, 1, memory_order_relaxed);
+        return -1;
+    }
+    pthread_cond_signal(&s->wake);
+    pthread_mutex_unlock(&s->lock);
+    return 0;
+}
+
+// Waiting for a group of tasks.
+void chttp_sched_wait(chttp_sched *s, chttp_task_group *g)
+{
+    chttp_sched_worker *w = sched_self;
+    if (w != NULL && w->sched == s)
+    {
+        while (atomic_load_explicit(&g->pending, memory_order_acquire) > 0)
+        {
+            chttp_task *t = sched_find(s, w);
+            if (t != NULL)
+                sched_run(s, t);
+            else
+                sched_yield();
+        }
+        return;
+    }
+
+    // Announcing the wait before looking at the group: the last task either
+    // sees the announcement and broadcasts under the lock, or its count is
+    // seen here.
+    pthread_mutex_lock(&s->lock);
+    atomic_fetch_add_explicit(&s->waiting, 1, memory_order_seq_cst);
+    while (atomic_load_explicit(&g->pending, memory_order_seq_cst) > 0)
+        pthread_cond_wait(&s->done, &s->lock);
+    atomic_fetch_sub_explicit(&s->waiting, 1, memory_order_relaxed);
+    pthread_mutex_unlock(&s->lock);
+}
+
+// Stopping a scheduler.
+void chttp_sched_stop(chttp_sched *s)
+{
+    pthread_mutex_lock(&s->lock);
+    s->stopping = true;
+    pthread_cond_broadcast(&s->wake);
+    pthread_mutex_unlock(&s->lock);
+
+    for (int i = 0; i < s->count; i++)
+        pthread_join(s->workers[i].thread, NULL);
+
+    free(s->workers);
+    free(s->shared);
+    pthread_mutex_destroy(&s->lock);
+    pthread_cond_destroy(&s->wake);
+    pthread_cond_destroy(&s->done);
+}
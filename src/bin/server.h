@@ -0,0 +1,781 @@
+#ifndef _CHTTP_SERVER_H_
+#define _CHTTP_SERVER_H_
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include "../lib/chttp.h"
+
+#define CHTTP_CONN_BUFFER_LENGTH (CHTTP_BODY_LENGTH * 2)
+#define CHTTP_REACTOR_EVENTS      256
+#define CHTTP_REACTOR_SPARE_ARENAS 64
+#define CHTTP_REACTOR_SPARE_CONNS 256
+#define CHTTP_REACTOR_ACCEPT_BACKOFF 10
+#define CHTTP_MAX_WORKERS         1024
+#define CHTTP_CONN_OUT_HIGHWATER  (64 * 1024)
+#define CHTTP_CONN_IOVECS          256
+#define CHTTP_CACHE_BUCKETS       1024
+#define CHTTP_CACHE_HEAD_LENGTH    512
+#define CHTTP_ETAG_LENGTH           64
+#define CHTTP_ALLOW_LENGTH         128
+#define CHTTP_MAX_RANGES            16
+#define CHTTP_DEQUE_LENGTH        4096
+#define CHTTP_GZIP_PART_LENGTH    (128 * 1024)
+
+// chttp_server_args
+//   Description:
+//     Structured container for server arguments.
+struct chttp_server_args
+{
+    char address[16];
+    uint16_t port;
+    int backlog;
+    int workers;
+    int keepalive_timeout;
+    int max_requests;
+    int accept_queue;
+    int max_connections;
+    int gzip_threads;
+    size_t cache_size;
+    size_t cache_file_max;
+    bool autoindex;
+    const char *mime_types;
+    bool pin;
+    bool help;
+    bool verbose;
+};
+typedef struct chttp_server_args chttp_server_args;
+
+typedef struct chttp_conn chttp_conn;
+typedef struct chttp_reactor chttp_reactor;
+
+// chttp_connection
+//   What a response says in its Connection header: nothing on a persistent
+//   HTTP/1.1 connection, "close" on the last response of any connection, and
+//   "keep-alive" on a persistent HTTP/1.0 connection, whose client otherwise
+//   takes the response to be the last.
+typedef enum
+{
+    CHTTP_CONNECTION_DEFAULT,
+    CHTTP_CONNECTION_CLOSE,
+    CHTTP_CONNECTION_KEEP_ALIVE,
+    CHTTP_CONNECTION_KINDS
+} chttp_connection;
+
+// chttp_ring_cell
+//   One slot of a chttp_ring. seq says whose turn the slot is: equal to a
+//   producer's position when it may be written, one past it once it holds a
+//   socket for the consumer at that position.
+typedef struct
+{
+    _Atomic size_t seq;
+    int sock;
+} chttp_ring_cell;
+
+// chttp_ring
+//   A bounded, lock-free, multi-producer multi-consumer queue of sockets. A
+//   producer claims a position with one compare-and-swap on head and a
+//   consumer with one on tail, so the two sides only contend among
+//   themselves, on separate cache lines.
+typedef struct
+{
+    chttp_ring_cell *cells;
+    size_t mask;
+    _Alignas(64) _Atomic size_t head;
+    _Alignas(64) _Atomic size_t tail;
+} chttp_ring;
+
+// chttp_ring_fill
+//   Parameters:
+//     * ring     - The ring to fill.
+//     * capacity - Number of sockets it holds, rounded up to a power of two.
+//
+//   Returns:
+//     -1 if the cells could not be allocated. 0 on success.
+int chttp_ring_fill(chttp_ring *ring, size_t capacity);
+
+// chttp_ring_push
+//   Parameters:
+//     * ring - The ring.
+//     * sock - The socket to queue.
+//
+//   Returns:
+//     false if the ring is full. true on success.
+bool chttp_ring_push(chttp_ring *ring, int sock);
+
+// chttp_ring_pop
+//   Parameters:
+//     * ring - The ring.
+//     * sock - Set to the oldest queued socket.
+//
+//   Returns:
+//     false if the ring is empty. true on success.
+bool chttp_ring_pop(chttp_ring *ring, int *sock);
+
+// chttp_ring_free
+//   Parameters:
+//     * ring - The ring, which should be empty.
+//
+//   Description:
+//     Releasing the ring's cells.
+void chttp_ring_free(chttp_ring *ring);
+
+// chttp_handler
+//   Called by the reactor once a complete request has been read from a
+//   connection. The handler queues its response with chttp_conn_write.
+//
+//   Returns:
+//     -1 to drop the connection without flushing. 0 otherwise.
+typedef int (*chttp_handler)(chttp_conn *c, chttp_request *req);
+
+// chttp_release
+//   Called once the reactor no longer needs memory queued with
+//   chttp_conn_write_ref.
+typedef void (*chttp_release)(void *arg);
+
+// chttp_write
+//   One pending piece of a connection's write queue: len bytes at data, len
+//   bytes spread over iovcnt buffers at iov, or, when fd is not -1, len bytes
+//   of fd starting at file_off. Consecutive memory pieces are sent together
+//   with one writev.
+typedef struct chttp_write chttp_write;
+struct chttp_write
+{
+    chttp_write *next;
+    const char *data;
+    const struct iovec *iov;
+    int iovcnt;
+    size_t len;
+    size_t off;
+
+    int fd;
+    off_t file_off;
+    bool close_fd;
+
+    chttp_release release;
+    void *release_arg;
+};
+
+// chttp_conn
+//   State for one client connection owned by a reactor. The arena, input
+//   buffer and write queue are only attached while the connection has work in
+//   flight, so an idle keep-alive connection costs little more than this
+//   struct. Pipelined requests are parsed from in + in_off onwards and their
+//   responses queued in order.
+struct chttp_conn
+{
+    int sock;
+    chttp_reactor *reactor;
+    chttp_arena *arena;
+
+    char *in;
+    size_t in_off;
+    size_t in_len;
+    chttp_parser parser;
+
+    chttp_write *out;
+    chttp_write *out_tail;
+    size_t out_bytes;
+
+    int requests;
+    bool keep_alive;
+    chttp_connection connection;
+    bool closing;
+
+    // Position in the reactor's list of connections, least recently active
+    // first.
+    chttp_conn *prev;
+    chttp_conn *next;
+    long last_active;
+};
+
+// chttp_reactor
+//   An edge-triggered epoll loop serving the connections accepted from its
+//   own listening socket, or handed to it through a shared ring by an
+//   acceptor. Arenas and connections released by finished clients are kept
+//   for the next ones, so a busy reactor stops allocating. Connections idle
+//   for longer than keepalive_timeout seconds are closed, and new ones beyond
+//   max_connections are turned away with 503 Service Unavailable.
+struct chttp_reactor
+{
+    int epfd;
+    int listener;
+    bool verbose;
+    chttp_handler handler;
+
+    chttp_ring *handoff;
+    int wakefd;
+
+    int keepalive_timeout;
+    int max_requests;
+    size_t max_connections;
+
+    chttp_arena *spare[CHTTP_REACTOR_SPARE_ARENAS];
+    int spare_len;
+    chttp_conn *spare_conns;
+    int spare_conns_len;
+    chttp_conn *closed;
+
+    chttp_conn *oldest;
+    chttp_conn *newest;
+    long now;
+    long accept_retry;
+    size_t connections;
+    _Atomic size_t shed;
+};
+
+// chttp_reactor_fill
+//   Parameters:
+//     * r        - The reactor to fill.
+//     * listener - A bound, listening, non-blocking socket.
+//     * handoff  - A ring an acceptor queues sockets on, used instead of the
+//                  listener when not NULL.
+//     * handler  - Called for every complete request.
+//     * args     - Server arguments, for logging and connection limits.
+//
+//   Description:
+//     Creating the epoll instance and registering the listener with it, or,
+//     with a handoff ring, an eventfd the acceptor wakes the reactor through.
+//
+//   Returns:
+//     -1 on error. 0 on success.
+int chttp_reactor_fill(chttp_reactor *r, int listener, chttp_ring *handoff, chttp_handler handler,
+                       const chttp_server_args *args);
+
+// chttp_reactor_run
+//   Parameters:
+//     * r - The reactor to run.
+//
+//   Description:
+//     Accepting and serving connections until an unrecoverable error.
+//
+//   Returns:
+//     -1 on error.
+int chttp_reactor_run(chttp_reactor *r);
+
+// chttp_reactor_wake
+//   Parameters:
+//     * r - A reactor filled with a handoff ring.
+//
+//   Description:
+//     Telling the reactor a socket has been queued on its ring. Every wake-up
+//     is answered by one pop, though any reactor sharing the ring may take
+//     any of the sockets.
+//
+//     One pop per wake-up only accounts for every socket because the ring has
+//     a single producer, chttp_acceptor_run, which pushes before it wakes. A
+//     second producer could have its socket popped for another's wake-up, so
+//     that a reactor finds the ring empty and a later socket waits for the
+//     next wake-up. Multiple producers would need reactors to pop until the
+//     ring is empty instead.
+void chttp_reactor_wake(chttp_reactor *r);
+
+// chttp_shed
+//   Parameters:
+//     * sock - An accepted socket that will not be served.
+//
+//   Description:
+//     Sending a canned 503 Service Unavailable without blocking, and closing
+//     the socket.
+void chttp_shed(int sock);
+
+// chttp_acceptor_run
+//   Parameters:
+//     * listener - A bound, listening socket.
+//     * ring     - The ring the reactors take sockets from.
+//     * reactors - The reactors, woken in turn for each socket.
+//     * count    - Number of reactors.
+//     * shed     - Counts the sockets turned away because the ring was full.
+//
+//   Description:
+//     Accepting connections on the calling thread and handing them to the
+//     reactors. When the ring is full the reactors are behind, so the
+//     connection is shed with 503 instead of queueing without bound.
+//
+//   Returns:
+//     -1 on error.
+int chttp_acceptor_run(int listener, chttp_ring *ring, chttp_reactor **reactors, int count, _Atomic size_t *shed);
+
+// chttp_task
+//   A unit of work for a chttp_sched. The memory belongs to whoever spawned
+//   it and must stay valid until run returns. group may be NULL.
+typedef struct chttp_task chttp_task;
+typedef struct chttp_task_group chttp_task_group;
+struct chttp_task
+{
+    void (*run)(chttp_task *t);
+    void *arg;
+    chttp_task_group *group;
+};
+
+// chttp_task_group
+//   Counts the tasks spawned into it that have not finished yet, so the
+//   spawner can wait for them with chttp_sched_wait.
+struct chttp_task_group
+{
+    _Atomic int pending;
+};
+
+// chttp_deque
+//   A Chase-Lev work-stealing deque of tasks. Only its owner pushes and pops,
+//   at the bottom, without a compare-and-swap unless the deque is down to its
+//   last task; other workers steal from the top.
+typedef struct
+{
+    _Alignas(64) _Atomic long top;
+    _Alignas(64) _Atomic long bottom;
+    _Atomic(chttp_task *) tasks[CHTTP_DEQUE_LENGTH];
+} chttp_deque;
+
+// chttp_deque_push
+//   Parameters:
+//     * d - The deque, owned by the calling thread.
+//     * t - The task.
+//
+//   Returns:
+//     -1 if the deque is full. 0 on success.
+int chttp_deque_push(chttp_deque *d, chttp_task *t);
+
+// chttp_deque_take
+//   Parameters:
+//     * d - The deque, owned by the calling thread.
+//
+//   Returns:
+//     The most recently pushed task, or NULL if the deque is empty or a thief
+//     took its last task first.
+chttp_task *chttp_deque_take(chttp_deque *d);
+
+// chttp_deque_steal
+//   Parameters:
+//     * d - Another thread's deque.
+//
+//   Returns:
+//     The oldest task, or NULL if the deque is empty or another thread got to
+//     it first.
+chttp_task *chttp_deque_steal(chttp_deque *d);
+
+typedef struct chttp_sched chttp_sched;
+
+// chttp_sched_worker
+//   One thread of a chttp_sched along with its deque.
+typedef struct
+{
+    pthread_t thread;
+    chttp_sched *sched;
+    int id;
+    unsigned int seed;
+    chttp_deque deque;
+    size_t steals;
+} chttp_sched_worker;
+
+// chttp_sched
+//   A fixed pool of threads running tasks. With stealing, a task spawned on
+//   a worker goes on that worker's own deque, where it is likely to find its
+//   data still in cache, and idle workers steal from the others. Tasks
+//   spawned from other threads, or that do not fit a full deque, go on a
+//   shared queue. Without stealing every task goes on the shared queue, as
+//   in a plain thread pool.
+struct chttp_sched
+{
+    chttp_sched_worker *workers;
+    int count;
+    bool stealing;
+
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    chttp_task **shared;
+    size_t shared_head;
+    size_t shared_len;
+    size_t shared_cap;
+    _Atomic size_t shared_count;
+    _Atomic int sleeping;
+    bool stopping;
+
+    pthread_cond_t done;
+    _Atomic int waiting;
+};
+
+// chttp_sched_fill
+//   Parameters:
+//     * s        - The scheduler to fill.
+//     * count    - Number of worker threads.
+//     * stealing - Whether workers keep deques and steal from each other,
+//                  rather than sharing one queue.
+//
+//   Description:
+//     Starting the worker threads.
+//
+//   Returns:
+//     -1 on error. 0 on success.
+int chttp_sched_fill(chttp_sched *s, int count, bool stealing);
+
+// chttp_sched_spawn
+//   Parameters:
+//     * s - The scheduler.
+//     * t - The task, counted in its group until it has run.
+//
+//   Returns:
+//     -1 if the shared queue could not grow. 0 on success.
+int chttp_sched_spawn(chttp_sched *s, chttp_task *t);
+
+// chttp_sched_wait
+//   Parameters:
+//     * s - The scheduler.
+//     * g - The group to wait for.
+//
+//   Description:
+//     Waiting for every task in a group to finish. A worker runs other tasks
+//     while it waits, so a task that splits its work and waits for the parts
+//     never leaves its thread idle. Any other thread, such as a reactor,
+//     sleeps until the group's last task has run, leaving its core to the
+//     workers.
+void chttp_sched_wait(chttp_sched *s, chttp_task_group *g);
+
+// chttp_sched_stop
+//   Parameters:
+//     * s - The scheduler.
+//
+//   Description:
+//     Letting the workers finish the queued tasks, joining them and releasing
+//     the scheduler's memory.
+void chttp_sched_stop(chttp_sched *s);
+
+// chttp_conn_write
+//   Parameters:
+//     * c    - The connection.
+//     * data - Bytes to send.
+//     * len  - Number of bytes in data.
+//
+//   Description:
+//     Copying data into the connection's arena and queueing it behind
+//     anything already waiting to be sent.
+//
+//   Returns:
+//     -1 if the arena could not grow. 0 on success.
+int chttp_conn_write(chttp_conn *c, const char *data, size_t len);
+
+// chttp_conn_write_ref
+//   Parameters:
+//     * c       - The connection.
+//     * data    - Bytes to send, which must stay valid until release is called.
+//     * len     - Number of bytes in data.
+//     * release - Called once the bytes are sent or the connection closes.
+//                 May be NULL.
+//     * arg     - Passed to release.
+//
+//   Description:
+//     Queueing data without copying it.
+//
+//   Returns:
+//     -1 if the arena could not grow, in which case release is not called.
+//     0 on success.
+int chttp_conn_write_ref(chttp_conn *c, const char *data, size_t len, chttp_release release, void *arg);
+
+// chttp_conn_writev
+//   Parameters:
+//     * c      - The connection.
+//     * iov    - Buffers to send, such as those from chttp_iov_response. Their
+//                contents must stay valid until sent, which holds for memory
+//                in the connection's arena.
+//     * iovcnt - Number of buffers.
+//
+//   Description:
+//     Queueing a list of buffers without copying their contents; only the
+//     iovec array itself is copied.
+//
+//   Returns:
+//     -1 if the arena could not grow. 0 on success.
+int chttp_conn_writev(chttp_conn *c, const struct iovec *iov, int iovcnt);
+
+// chttp_conn_sendfile
+//   Parameters:
+//     * c        - The connection.
+//     * fd       - A regular file to send from.
+//     * offset   - Where in the file to start.
+//     * len      - Number of bytes to send.
+//     * close_fd - Whether the connection should close fd once the bytes are
+//                  sent, or when it is closed itself.
+//
+//   Description:
+//     Queueing part of a file, which is later sent with sendfile(2) so the
+//     bytes never pass through user space.
+//
+//   Returns:
+//     -1 if the arena could not grow, in which case fd is left open. 0 on
+//     success.
+int chttp_conn_sendfile(chttp_conn *c, int fd, off_t offset, size_t len, bool close_fd);
+
+// chttp_conn_sink
+//   Parameters:
+//     * arg    - The chttp_conn.
+//     * iov    - Buffers to send.
+//     * iovcnt - Number of buffers.
+//
+//   Description:
+//     A chttp_sink for writing a response piece by piece, e.g. with the chunked
+//     writer. The buffers are copied into the queue and as much of the queue
+//     as the socket takes is sent straight away, so the client sees the start
+//     of the response before the handler has finished producing it.
+//
+//   Returns:
+//     -1 if the arena could not grow or the connection failed. 0 on success.
+int chttp_conn_sink(void *arg, const struct iovec *iov, int iovcnt);
+
+// chttp_conn_keep_alive
+//   Parameters:
+//     * c - The connection.
+//
+//   Description:
+//     Whether the connection stays open after the response to the current
+//     request.
+bool chttp_conn_keep_alive(chttp_conn *c);
+
+// chttp_conn_connection
+//   Parameters:
+//     * c - The connection.
+//
+//   Returns:
+//     What the response to the current request has to say about the
+//     connection, for chttp_connection_value or a pre-serialized head.
+chttp_connection chttp_conn_connection(chttp_conn *c);
+
+// chttp_connection_value
+//   Parameters:
+//     * connection - What a response has to say about its connection.
+//
+//   Returns:
+//     The value of its Connection header, or NULL if it needs none.
+const char *chttp_connection_value(chttp_connection connection);
+
+// chttp_conn_arena
+//   Parameters:
+//     * c - The connection.
+//
+//   Returns:
+//     The arena holding the current request, for handlers to allocate their
+//     response from.
+chttp_arena *chttp_conn_arena(chttp_conn *c);
+
+// chttp_cache_variant
+//   One representation of a cached file: its bytes, its entity tag and its
+//   200 response head, pre-serialized once for every chttp_connection.
+typedef struct
+{
+    char *head[CHTTP_CONNECTION_KINDS];
+    size_t head_len[CHTTP_CONNECTION_KINDS];
+    char *body;
+    size_t body_len;
+    char etag[CHTTP_ETAG_LENGTH];
+} chttp_cache_variant;
+
+// chttp_cache_entry
+//   A cached file: the file as it is on disk, a gzip-encoded variant made the
+//   first time a client accepts it, and the stat identity used to notice when
+//   the file changes. Entries are reference counted so eviction never frees
+//   bytes that are still queued on a connection.
+typedef struct chttp_cache_entry chttp_cache_entry;
+struct chttp_cache_entry
+{
+    chttp_cache_entry *bucket_next;
+    chttp_cache_entry *lru_prev;
+    chttp_cache_entry *lru_next;
+    struct chttp_cache *cache;
+
+    char *path;
+    unsigned int hash;
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+    time_t checked;
+    char etag[CHTTP_ETAG_LENGTH];
+    const char *type;
+
+    chttp_cache_variant identity;
+    chttp_cache_variant *gzip;
+    bool gzip_tried;
+
+    int refs;
+    bool evicted;
+};
+
+// chttp_cache
+//   Bounded, LRU-evicted cache of small files under the document root, shared
+//   by every reactor.
+typedef struct chttp_cache
+{
+    pthread_mutex_t lock;
+    chttp_cache_entry *buckets[CHTTP_CACHE_BUCKETS];
+    chttp_cache_entry *lru_newest;
+    chttp_cache_entry *lru_oldest;
+
+    size_t bytes;
+    size_t max_bytes;
+    size_t max_file;
+    chttp_sched *sched;
+
+    size_t hits;
+    size_t misses;
+    size_t evictions;
+
+    size_t gzip_hits;
+    size_t gzip_compressed;
+    size_t gzip_static;
+    size_t gzip_in;
+    size_t gzip_out;
+    uint64_t gzip_cpu_ns;
+} chttp_cache;
+
+// chttp_cache_fill
+//   Parameters:
+//     * cache     - The cache to fill.
+//     * max_bytes - Total size of the cached files. 0 disables the cache.
+//     * max_file  - Largest file worth caching.
+//     * sched     - Scheduler large files are compressed on, or NULL to
+//                   compress on the calling reactor.
+void chttp_cache_fill(chttp_cache *cache, size_t max_bytes, size_t max_file, chttp_sched *sched);
+
+// chttp_cache_get
+//   Parameters:
+//     * cache - The cache.
+//     * path  - Path of the file on disk.
+//
+//   Description:
+//     Looking up a file, loading it on a miss if it is small enough. A hit is
+//     re-checked against the file's stat identity at most once a second.
+//
+//   Returns:
+//     A referenced entry, to be handed back with chttp_cache_release, or NULL
+//     if the file is missing, not regular or not cacheable.
+chttp_cache_entry *chttp_cache_get(chttp_cache *cache, const char *path);
+
+// chttp_cache_gzip
+//   Parameters:
+//     * cache - The cache.
+//     * e     - A referenced entry.
+//
+//   Description:
+//     Getting the gzip-encoded variant of a cached file. The first call for an
+//     entry reads the file's ".gz" sibling if there is one no older than the
+//     file, or else compresses
+//     the file, and keeps the result with the entry so it counts towards the
+//     cache's size and goes when the entry does. Files whose type does not
+//     compress, or that do not shrink, get no variant.
+//
+//   Returns:
+//     The variant, valid as long as the reference to e, or NULL if the file
+//     should be sent as it is.
+chttp_cache_variant *chttp_cache_gzip(chttp_cache *cache, chttp_cache_entry *e);
+
+// chttp_cache_release
+//   Parameters:
+//     * arg - A chttp_cache_entry returned by chttp_cache_get.
+//
+//   Description:
+//     Dropping a reference. Has the chttp_release signature so it can be
+//     passed straight to chttp_conn_write_ref.
+void chttp_cache_release(void *arg);
+
+// chttp_cache_print_stats
+//   Parameters:
+//     * cache - The cache.
+//     * f     - File pointer to print to.
+void chttp_cache_print_stats(chttp_cache *cache, FILE *f);
+
+// chttp_file_etag
+//   Parameters:
+//     * st  - The file's metadata.
+//     * buf - Buffer for the quoted entity tag.
+//     * len - Length of buf.
+//
+//   Description:
+//     Deriving a strong entity tag from a file's inode, size and mtime.
+void chttp_file_etag(const struct stat *st, char *buf, size_t len);
+
+// chttp_file_older
+//   Parameters:
+//     * st - A file's metadata.
+//     * t  - The time to compare with.
+//
+//   Returns:
+//     Whether the file was last modified before t, such as a ".gz" sibling
+//     left over from an earlier version of the file.
+bool chttp_file_older(const struct stat *st, struct timespec t);
+
+// chttp_file_type
+//   Parameters:
+//     * path - The file's path.
+//
+//   Returns:
+//     The MIME type for the file's suffix from chttp_mime_lookup, or NULL if
+//     it has none or it is unknown.
+const char *chttp_file_type(const char *path);
+
+// chttp_accepts_gzip
+//   Parameters:
+//     * value - The request's Accept-Encoding header, or NULL.
+//
+//   Returns:
+//     Whether the client accepts a gzip-encoded response, honoring q-values
+//     and "*".
+bool chttp_accepts_gzip(const char *value);
+
+// chttp_type_compressible
+//   Parameters:
+//     * type - A MIME type, or NULL.
+//
+//   Returns:
+//     Whether bodies of that type are worth compressing: text and the
+//     textual application formats, but not images, audio, video or archives
+//     that are compressed already.
+bool chttp_type_compressible(const char *type);
+
+// chttp_gzip
+//   Parameters:
+//     * s       - Scheduler to compress on, or NULL.
+//     * data    - Bytes to compress.
+//     * len     - Number of bytes.
+//     * out_len - Set to the length of the result.
+//     * cpu_ns  - Set to the CPU time spent compressing, in nanoseconds, on
+//                 whichever threads did it.
+//
+//   Description:
+//     Compressing data in one pass, or, with a scheduler and at least two
+//     CHTTP_GZIP_PART_LENGTH parts of data, as one task that splits itself
+//     into a subtask per part. The parts are compressed on the workers, each
+//     primed with the 32 KB before it, and joined into a single gzip member.
+//     The calling thread waits for them.
+//
+//   Returns:
+//     The data in gzip format, to be released with free, or NULL if zlib
+//     failed.
+char *chttp_gzip(chttp_sched *s, const char *data, size_t len, size_t *out_len, uint64_t *cpu_ns);
+
+// chttp_http_date
+//   Parameters:
+//     * t   - The time to format.
+//     * buf - Buffer for the IMF-fixdate, e.g. "Sun, 06 Nov 1994 08:49:37 GMT".
+//     * len - Length of buf.
+void chttp_http_date(time_t t, char *buf, size_t len);
+
+// chttp_stats_requested
+//   Set by the SIGUSR1 handler; the reactor that notices it prints the
+//   server's counters with chttp_server_print_stats.
+extern volatile sig_atomic_t chttp_stats_requested;
+
+// chttp_server_print_stats
+//   Parameters:
+//     * f - File pointer to print to.
+//
+//   Description:
+//     Printing the server-wide counters. Implemented by the server binary.
+void chttp_server_print_stats(FILE *f);
+
+#endif
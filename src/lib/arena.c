@@ -0,0 +1,101 @@
+#include "chttp.h"
+
+#include <stdlib.h>
+#include <stddef.h>
+
+// A block of arena memory. Allocations are carved out of data.
+struct chttp_arena_block
+{
+    chttp_arena_block *next;
+    size_t size;
+    size_t used;
+    max_align_t data[];
+};
+
+// Rounding len up to the alignment every allocation gets.
+static inline size_t align_up(size_t len)
+{
+    const size_t align = sizeof(max_align_t);
+    return (len + align - 1) & ~(align - 1);
+}
+
+// Filling an arena.
+void chttp_arena_fill(chttp_arena *a, size_t block_size)
+{
+    a->head = NULL;
+    a->current = NULL;
+    a->block_size = block_size;
+    a->allocs = 0;
+    a->system_allocs = 0;
+}
+
+// Allocating the space for a chttp_arena.
+chttp_arena *chttp_arena_allocate(size_t block_size)
+{
+    chttp_arena *a = (chttp_arena *)malloc(sizeof(chttp_arena));
+    chttp_arena_fill(a, block_size);
+    return a;
+}
+
+// Freeing a chttp_arena and its blocks.
+void chttp_arena_free(chttp_arena *a)
+{
+    chttp_arena_block *b = a->head;
+    while (b != NULL)
+    {
+        chttp_arena_block *next = b->next;
+        free(b);
+        b = next;
+    }
+    free(a);
+}
+
+// Allocating from the current block, moving on to (or creating) the next one
+// when it is full.
+void *chttp_arena_alloc(chttp_arena *a, size_t len)
+{
+    len = align_up(len);
+    a->allocs++;
+
+    chttp_arena_block *b = a->current;
+    while (b != NULL && b->size - b->used < len)
+    {
+        b = b->next;
+        if (b != NULL)
+            b->used = 0;
+    }
+
+    if (b == NULL)
+    {
+        size_t size = len > a->block_size ? len : a->block_size;
+        b = (chttp_arena_block *)malloc(sizeof(chttp_arena_block) + size);
+        if (b == NULL)
+            return NULL;
+        a->system_allocs++;
+
+        b->size = size;
+        b->used = 0;
+        if (a->current == NULL)
+        {
+            b->next = a->head;
+            a->head = b;
+        } else
+        {
+            b->next = a->current->next;
+            a->current->next = b;
+        }
+    }
+
+    a->current = b;
+    void *p = (char *)b->data + b->used;
+    b->used += len;
+    return p;
+}
+
+// Resetting an arena, keeping its blocks.
+void chttp_arena_reset(chttp_arena *a)
+{
+    a->current = a->head;
+    if (a->head != NULL)
+        a->head->used = 0;
+}
@@ -2,26 +2,204 @@
 #define _CHTTP_HTTP_H_
 
 #include <stdio.h>
+#include <time.h>
+#include <sys/uio.h>
 
 #include "chttp_defines.h"
 
+// chttp_arena
+//   Bump allocator for objects that all die together, such as everything
+//   belonging to one request on a keep-alive connection. Memory is taken from
+//   a chain of blocks and handed back all at once by chttp_arena_reset, which
+//   keeps the blocks for reuse, so a connection in steady state stops calling
+//   malloc altogether. Internal values other than the counters should NOT be
+//   used.
+typedef struct chttp_arena_block chttp_arena_block;
+typedef struct
+{
+    chttp_arena_block *head;
+    chttp_arena_block *current;
+    size_t block_size;
+
+    size_t allocs;
+    size_t system_allocs;
+} chttp_arena;
+
+// chttp_arena_fill
+//   Parameters:
+//     * a          - The arena to fill.
+//     * block_size - Size of each block requested from malloc. Larger
+//                    allocations get a block of their own.
+//
+//   Description:
+//     Filling a chttp_arena in-place. No memory is allocated until the first
+//     chttp_arena_alloc.
+void chttp_arena_fill(chttp_arena *a, size_t block_size);
+
+// chttp_arena_allocate
+//   Parameters:
+//     * block_size - Size of each block requested from malloc.
+//
+//   Description:
+//     Allocates space for a chttp_arena and calls chttp_arena_fill on it.
+//
+//   Returns:
+//     The allocated chttp_arena.
+chttp_arena *chttp_arena_allocate(size_t block_size);
+
+// chttp_arena_free
+//   Parameters:
+//     * a - The arena to free.
+//
+//   Description:
+//     Freeing an arena along with every block it holds.
+void chttp_arena_free(chttp_arena *a);
+
+// chttp_arena_alloc
+//   Parameters:
+//     * a   - The arena.
+//     * len - Number of bytes needed.
+//
+//   Description:
+//     Allocating len bytes, aligned for any type. a->allocs counts every call,
+//     a->system_allocs counts the calls that had to go to malloc for a new
+//     block.
+//
+//   Returns:
+//     The allocated memory, or NULL if malloc failed.
+void *chttp_arena_alloc(chttp_arena *a, size_t len);
+
+// chttp_arena_reset
+//   Parameters:
+//     * a - The arena.
+//
+//   Description:
+//     Releasing everything allocated from the arena at once. Blocks are kept
+//     and reused by later allocations.
+void chttp_arena_reset(chttp_arena *a);
+
+// chttp_header_id
+//   Identifiers for well-known header names, so code handling them can switch
+//   on an integer instead of comparing strings. Any other name is
+//   CHTTP_HEADER_UNKNOWN.
+typedef enum
+{
+    CHTTP_HEADER_UNKNOWN,
+    CHTTP_HEADER_ACCEPT,
+    CHTTP_HEADER_ACCEPT_CHARSET,
+    CHTTP_HEADER_ACCEPT_ENCODING,
+    CHTTP_HEADER_ACCEPT_LANGUAGE,
+    CHTTP_HEADER_ACCEPT_RANGES,
+    CHTTP_HEADER_AGE,
+    CHTTP_HEADER_ALLOW,
+    CHTTP_HEADER_AUTHORIZATION,
+    CHTTP_HEADER_CACHE_CONTROL,
+    CHTTP_HEADER_CONNECTION,
+    CHTTP_HEADER_CONTENT_DISPOSITION,
+    CHTTP_HEADER_CONTENT_ENCODING,
+    CHTTP_HEADER_CONTENT_LANGUAGE,
+    CHTTP_HEADER_CONTENT_LENGTH,
+    CHTTP_HEADER_CONTENT_LOCATION,
+    CHTTP_HEADER_CONTENT_RANGE,
+    CHTTP_HEADER_CONTENT_TYPE,
+    CHTTP_HEADER_COOKIE,
+    CHTTP_HEADER_DATE,
+    CHTTP_HEADER_ETAG,
+    CHTTP_HEADER_EXPECT,
+    CHTTP_HEADER_EXPIRES,
+    CHTTP_HEADER_FORWARDED,
+    CHTTP_HEADER_FROM,
+    CHTTP_HEADER_HOST,
+    CHTTP_HEADER_IF_MATCH,
+    CHTTP_HEADER_IF_MODIFIED_SINCE,
+    CHTTP_HEADER_IF_NONE_MATCH,
+    CHTTP_HEADER_IF_RANGE,
+    CHTTP_HEADER_IF_UNMODIFIED_SINCE,
+    CHTTP_HEADER_KEEP_ALIVE,
+    CHTTP_HEADER_LAST_MODIFIED,
+    CHTTP_HEADER_LOCATION,
+    CHTTP_HEADER_ORIGIN,
+    CHTTP_HEADER_PRAGMA,
+    CHTTP_HEADER_RANGE,
+    CHTTP_HEADER_REFERER,
+    CHTTP_HEADER_RETRY_AFTER,
+    CHTTP_HEADER_SERVER,
+    CHTTP_HEADER_SET_COOKIE,
+    CHTTP_HEADER_TE,
+    CHTTP_HEADER_TRAILER,
+    CHTTP_HEADER_TRANSFER_ENCODING,
+    CHTTP_HEADER_UPGRADE,
+    CHTTP_HEADER_USER_AGENT,
+    CHTTP_HEADER_VARY,
+    CHTTP_HEADER_VIA,
+    CHTTP_HEADER_WWW_AUTHENTICATE,
+    CHTTP_HEADER_X_FORWARDED_FOR,
+    CHTTP_HEADER_COUNT
+} chttp_header_id;
+
+// chttp_header_lookup
+//   Parameters:
+//     * name - Header name, need not be NUL-terminated.
+//     * len  - Length of name.
+//
+//   Description:
+//     Recognizing a well-known header name, ignoring case. Costs one perfect
+//     hash and at most one comparison.
+//
+//   Returns:
+//     The header's chttp_header_id, or CHTTP_HEADER_UNKNOWN.
+chttp_header_id chttp_header_lookup(const char *name, size_t len);
+
+// chttp_header_name
+//   Parameters:
+//     * id - A well-known header.
+//
+//   Returns:
+//     The canonical spelling of the header's name, or NULL for
+//     CHTTP_HEADER_UNKNOWN.
+const char *chttp_header_name(chttp_header_id id);
+
 // chttp_header
-//   Struct containing header/value key-pair for a given header.
+//   Location of a header/value key-pair within its header set's string
+//   storage. Both strings are NUL-terminated there. id tells which well-known
+//   header it is, if any.
 typedef struct
 {
-    char header[CHTTP_HEADER_KEY_LENGTH];
-    char value[CHTTP_HEADER_VALUE_LENGTH];
+    unsigned int header;
+    unsigned int header_len;
+    unsigned int value;
+    unsigned int value_len;
+
+    unsigned int hash;
+    int next;
+    chttp_header_id id;
 } chttp_header;
 
 // chttp_header_set
 //   Struct used as a front-end for a "header_set" whose "methods" are
 //   implemented below. Internal values should NOT be used, as they are subject
 //   to change and optimization.
+//
+//   Header names and values are packed back to back into one string buffer,
+//   and the headers array holds their offsets in insertion order. An
+//   open-addressed hash index of case-folded names sits on the side. Entries
+//   sharing a name are chained through chttp_header.next so multi-valued
+//   fields like Set-Cookie stay in order.
 typedef struct
 {
     int size;
     int len;
     chttp_header *headers;
+
+    int index_size;
+    int *index;
+
+    char *data;
+    size_t data_len;
+    size_t data_size;
+    size_t budget;
+
+    chttp_arena *arena;
 } chttp_header_set;
 
 // chttp_header_set_fill
@@ -43,6 +221,25 @@ void chttp_header_set_fill(chttp_header_set *s);
 //     The allocated chttp_header_set.
 chttp_header_set *chttp_header_set_allocate();
 
+// chttp_header_set_arena_fill
+//   Parameters:
+//     * s - The header set to fill.
+//     * a - The arena its storage comes from.
+//
+//   Description:
+//     chttp_header_set_fill for a header set whose headers, index and strings
+//     all live in an arena. Such a set is released by chttp_arena_reset, and
+//     chttp_header_set_free does nothing to it.
+void chttp_header_set_arena_fill(chttp_header_set *s, chttp_arena *a);
+
+// chttp_header_set_arena_allocate
+//   Parameters:
+//     * a - The arena to allocate from.
+//
+//   Returns:
+//     A chttp_header_set allocated from and backed by the arena.
+chttp_header_set *chttp_header_set_arena_allocate(chttp_arena *a);
+
 // chttp_header_set_free
 //   Parameters:
 //     * s - The header set to free.
@@ -52,6 +249,17 @@ chttp_header_set *chttp_header_set_allocate();
 //     the header set.
 void chttp_header_set_free(chttp_header_set *s);
 
+// chttp_header_set_budget
+//   Parameters:
+//     * s      - The header set.
+//     * budget - Maximum number of bytes all header names and values may take
+//                up together.
+//
+//   Description:
+//     Setting the total size limit enforced by chttp_add_header. Defaults to
+//     CHTTP_HEADER_BUDGET.
+void chttp_header_set_budget(chttp_header_set *s, size_t budget);
+
 // chttp_add_header
 //   Parameters:
 //     * set    - Pointer to the header set.
@@ -59,22 +267,78 @@ void chttp_header_set_free(chttp_header_set *s);
 //     * value  - Header value.
 //
 //   Description:
-//     Adds a header to the header set.
-void chttp_add_header(chttp_header_set *set, const char *header, const char *value);
+//     Adds a header to the header set. Adding a header may move the header
+//     set's string storage, so strings previously returned by the functions
+//     below must not be used afterwards.
+//
+//   Returns:
+//     -1 if the header would exceed the set's budget or memory runs out, in
+//     which case the set is left as it was. 0 on success.
+int chttp_add_header(chttp_header_set *set, const char *header, const char *value);
+
+// chttp_add_header_n
+//   Parameters:
+//     * set        - Pointer to the header set.
+//     * header     - Header key, need not be NUL-terminated.
+//     * header_len - Length of header.
+//     * value      - Header value, need not be NUL-terminated.
+//     * value_len  - Length of value.
+//
+//   Description:
+//     chttp_add_header for strings with a known length.
+//
+//   Returns:
+//     -1 if the header would exceed the set's budget or memory runs out, in
+//     which case the set is left as it was. 0 on success.
+int chttp_add_header_n(chttp_header_set *set, const char *header, size_t header_len,
+                       const char *value, size_t value_len);
+
+// chttp_header_key
+//   Parameters:
+//     * set - The header set.
+//     * i   - Position of the header, 0 <= i < set->len, in insertion order.
+//
+//   Returns:
+//     The name of the i-th header.
+char *chttp_header_key(chttp_header_set *set, int i);
+
+// chttp_header_value
+//   Parameters:
+//     * set - The header set.
+//     * i   - Position of the header, 0 <= i < set->len, in insertion order.
+//
+//   Returns:
+//     The value of the i-th header.
+char *chttp_header_value(chttp_header_set *set, int i);
 
 // chttp_get_header
 //   Parameters:
 //     * set    - The header set.
-//     * header - Header key.
+//     * header - Header key, compared case-insensitively.
 //
 //   Description:
-//     Retrieves a header specified from the header set.
+//     Retrieves a header specified from the header set. If the header was
+//     added more than once, this is the first value added.
 //
 //   Returns:
 //     NULL if the header is not found. Otherwise, a string with the header's
 //     value.
 char *chttp_get_header(chttp_header_set *set, const char *header);
 
+// chttp_get_header_next
+//   Parameters:
+//     * set    - The header set.
+//     * header - Header key, compared case-insensitively.
+//     * it     - Iterator position. Set it to -1 before the first call.
+//
+//   Description:
+//     Iterates over every value of a header that was added more than once, in
+//     the order they were added.
+//
+//   Returns:
+//     NULL once there are no more values. Otherwise, the next value.
+char *chttp_get_header_next(chttp_header_set *set, const char *header, int *it);
+
 // chttp_method
 //   Enumeration of all possible HTTP methods. Used in place of a string (e.g.
 //   "OPTIONS" and "GET") for type-safety.
@@ -88,9 +352,63 @@ typedef enum
     DELETE,
     TRACE,
     CONNECT,
+    PATCH,
     OTHER
 } chttp_method;
 
+// chttp_method_lookup
+//   Parameters:
+//     * name - Method token, need not be NUL-terminated.
+//     * len  - Length of name.
+//
+//   Description:
+//     Recognizing a standard method. Methods are case-sensitive, and each is
+//     matched with one comparison of its bytes loaded as a word.
+//
+//   Returns:
+//     The chttp_method, or OTHER if the token is not a standard method.
+chttp_method chttp_method_lookup(const char *name, size_t len);
+
+// chttp_method_name
+//   Parameters:
+//     * method - The method.
+//
+//   Returns:
+//     The method's token as a static string, "OTHER" for OTHER.
+const char *chttp_method_name(chttp_method method);
+
+// chttp_method_register
+//   Parameters:
+//     * name - Extension method token.
+//
+//   Description:
+//     Adding an extension method to the process-wide table of
+//     CHTTP_METHOD_INTERN_COUNT entries that chttp_method_intern looks tokens
+//     up in. Meant for start-up, before requests arrive; entries are never
+//     freed. Safe to call from several threads.
+//
+//   Returns:
+//     The interned token, chttp_method_name for a standard method, or NULL if
+//     it is longer than CHTTP_METHOD_NAME_LENGTH - 1 or the table is full.
+const char *chttp_method_register(const char *name);
+
+// chttp_method_intern
+//   Parameters:
+//     * name - Method token, need not be NUL-terminated.
+//     * len  - Length of name.
+//
+//   Description:
+//     Mapping a method token to its one shared, NUL-terminated copy, so equal
+//     tokens give equal pointers and an extension method can be compared
+//     without strcmp. Standard methods map to chttp_method_name and
+//     extension methods to their chttp_method_register entry. Never adds to
+//     the table, so request input cannot fill it. Safe to call from several
+//     threads.
+//
+//   Returns:
+//     The interned token, or NULL if the method is not registered.
+const char *chttp_method_intern(const char *name, size_t len);
+
 // chttp_sprint_method
 //   Parameters:
 //     * method - The HTTP method to print.
@@ -104,18 +422,61 @@ typedef enum
 //     The number of characters printed into the string.
 size_t chttp_sprint_method(chttp_method method, char *str, int len);
 
+// chttp_body_producer
+//   Supplies a body to the print functions piece by piece, so it never has to
+//   be in memory all at once.
+//
+//   Parameters:
+//     * arg - The message's body_producer_arg.
+//     * buf - Buffer to fill.
+//     * len - Length of buf.
+//
+//   Returns:
+//     The number of bytes written to buf, 0 once the body is finished or -1 on
+//     error.
+typedef long (*chttp_body_producer)(void *arg, char *buf, size_t len);
+
+// chttp_fd_producer
+//   Parameters:
+//     * arg - A file descriptor cast with (void *)(intptr_t)fd.
+//     * buf - Buffer to fill.
+//     * len - Length of buf.
+//
+//   Description:
+//     A chttp_body_producer reading a body from a file descriptor until its end.
+long chttp_fd_producer(void *arg, char *buf, size_t len);
+
 // chttp_request
 //   Modeling the data passed from a browser requesting a given page. Used in
 //   tandem with the parse functions below to deal with HTTP requests.
+//
+//   The body is body_len bytes at body and may hold binary data. Parsed bodies
+//   are owned by the request and followed by a NUL; otherwise body may point at
+//   any memory that outlives the request. When body_len is 0 and
+//   body_producer is set, the print functions pull the body from it instead.
+//   body_storage is internal.
+//
+//   method_name is the token of the method as parsed, which is how an OTHER
+//   method is told apart. Standard and registered methods point at their
+//   interned token, so they compare by pointer; any other method points at a
+//   copy in method_token. It may be NULL, in which case the method is printed
+//   from the enum.
 typedef struct
 {
     chttp_method method;
+    const char *method_name;
+    char method_token[CHTTP_METHOD_NAME_LENGTH];
     char uri[CHTTP_URI_LENGTH];
     char http_version[CHTTP_HTTP_VERSION_LENGTH];
 
     chttp_header_set *headers;
 
-    char body[CHTTP_BODY_LENGTH];
+    char *body;
+    size_t body_len;
+    chttp_body_producer body_producer;
+    void *body_producer_arg;
+
+    char *body_storage;
 } chttp_request;
 
 // chttp_request_fill
@@ -136,6 +497,18 @@ void chttp_request_fill(chttp_request *r);
 //     Returns the allocating chttp_request.
 chttp_request *chttp_request_allocate();
 
+// chttp_request_arena_allocate
+//   Parameters:
+//     * a - The arena to allocate from.
+//
+//   Description:
+//     Allocates a chttp_request and its header set from an arena. The request
+//     is released by chttp_arena_reset; chttp_request_free does nothing to it.
+//
+//   Returns:
+//     The allocated chttp_request, or NULL if the arena could not grow.
+chttp_request *chttp_request_arena_allocate(chttp_arena *a);
+
 // chttp_request_free
 //   Parameters:
 //     * r - The request to free.
@@ -146,7 +519,13 @@ void chttp_request_free(chttp_request *r);
 
 // chttp_response
 //   Modeling the data passed from a server would pass back to the client. Used
-//   in tandem with the print functions below to deal with HTTP responses.
+//   in tandem with the print functions below to deal with HTTP responses. The
+//   body is held as in chttp_request.
+//
+//   http_version and reason_phrase may be left empty, implying "HTTP/1.1" and
+//   the code's registered reason phrase. A response whose status line is
+//   implied, or matches the registered one, is printed from a table of
+//   pre-rendered status lines.
 typedef struct
 {
     char http_version[CHTTP_HTTP_VERSION_LENGTH];
@@ -155,7 +534,12 @@ typedef struct
 
     chttp_header_set *headers;
 
-    char body[CHTTP_BODY_LENGTH];
+    char *body;
+    size_t body_len;
+    chttp_body_producer body_producer;
+    void *body_producer_arg;
+
+    char *body_storage;
 } chttp_response;
 
 // chttp_response_fill
@@ -176,6 +560,19 @@ void chttp_response_fill(chttp_response *r);
 //     Returns the allocating chttp_response.
 chttp_response *chttp_response_allocate();
 
+// chttp_response_arena_allocate
+//   Parameters:
+//     * a - The arena to allocate from.
+//
+//   Description:
+//     Allocates a chttp_response and its header set from an arena. The
+//     response is released by chttp_arena_reset; chttp_response_free does
+//     nothing to it.
+//
+//   Returns:
+//     The allocated chttp_response, or NULL if the arena could not grow.
+chttp_response *chttp_response_arena_allocate(chttp_arena *a);
+
 // chttp_response_free
 //   Parameters:
 //     * r - The response to free.
@@ -191,7 +588,9 @@ void chttp_response_free(chttp_response *r);
 //
 //   Description:
 //     Parsing a chttp_request from a FILE pointer. Inverse of
-//     chttp_sprint_request.
+//     chttp_sprint_request. The body is read as framed by Transfer-Encoding:
+//     chunked or Content-Length, or up to the end of the stream if neither is
+//     given.
 //
 //   Returns:
 //     The number of characters read on success. Returns -1 on failure.
@@ -204,7 +603,7 @@ size_t chttp_parse_request(chttp_request *r, FILE *f);
 //
 //   Description:
 //     Parsing a chttp_response from a FILE pointer. Inverse of
-//     chttp_sprint_response.
+//     chttp_sprint_response. The body is framed as in chttp_parse_request.
 //
 //   Returns:
 //     The number of characters read on success. Returns -1 on failure.
@@ -238,6 +637,208 @@ size_t chttp_sparse_request(chttp_request *r, const char *string, int len);
 //     The number of characters read from the string. Returns -1 on failure.
 size_t chttp_sparse_response(chttp_response *r, const char *string, int len);
 
+// chttp_span
+//   An offset/length pair describing a region of a caller-owned buffer. Used by
+//   the zero-copy parse functions in place of copied, NUL-terminated strings.
+typedef struct
+{
+    size_t off;
+    size_t len;
+} chttp_span;
+
+// chttp_span_header
+//   Header name/value pair as spans into the parsed buffer, along with which
+//   well-known header it is.
+typedef struct
+{
+    chttp_span name;
+    chttp_span value;
+    chttp_header_id id;
+} chttp_span_header;
+
+// chttp_request_view
+//   Zero-copy counterpart to chttp_request. Every field is a span into the
+//   buffer that was parsed, so the buffer must outlive the view. Header spans
+//   are kept in parse order.
+typedef struct
+{
+    chttp_method method;
+    chttp_span method_name;
+    chttp_span uri;
+    chttp_span http_version;
+
+    int header_count;
+    chttp_span_header headers[CHTTP_VIEW_HEADER_COUNT];
+
+    chttp_span body;
+} chttp_request_view;
+
+#define CHTTP_PARSE_ERROR      -1
+#define CHTTP_PARSE_INCOMPLETE -2
+
+// chttp_parse_request_view
+//   Parameters:
+//     * v   - The view to fill.
+//     * buf - The buffer to parse.
+//     * len - The number of bytes in buf.
+//
+//   Description:
+//     Parsing the request line and headers of a request directly from a
+//     buffer, without copying. Both CRLF and bare LF line endings are accepted.
+//     Everything after the blank line ending the headers becomes the body.
+//
+//   Returns:
+//     The length of the request line plus headers (including the blank line)
+//     on success. CHTTP_PARSE_INCOMPLETE if the end of the headers is not yet
+//     in the buffer. CHTTP_PARSE_ERROR if the request is malformed or has more
+//     than CHTTP_VIEW_HEADER_COUNT headers.
+long chttp_parse_request_view(chttp_request_view *v, const char *buf, size_t len);
+
+// chttp_view_find_header
+//   Parameters:
+//     * v      - The parsed view.
+//     * buf    - The buffer the view was parsed from.
+//     * header - Header name to look for, compared case-insensitively.
+//
+//   Returns:
+//     The index of the first matching entry in v->headers, or -1 if there is
+//     none.
+int chttp_view_find_header(const chttp_request_view *v, const char *buf, const char *header);
+
+// chttp_view_find_known
+//   Parameters:
+//     * v  - The parsed view.
+//     * id - The well-known header to look for.
+//
+//   Returns:
+//     The index of the first entry in v->headers with that id, or -1 if there
+//     is none. Unlike chttp_view_find_header, no string is compared.
+int chttp_view_find_known(const chttp_request_view *v, chttp_header_id id);
+
+// chttp_request_from_view
+//   Parameters:
+//     * r   - A filled chttp_request to copy into.
+//     * v   - The parsed view.
+//     * buf - The buffer the view was parsed from.
+//
+//   Description:
+//     Copying a view into the fixed-size fields of a chttp_request, for code
+//     that still works with the string-based API. The body is not copied;
+//     r->body points into buf, which must outlive the request.
+//
+//   Returns:
+//     -1 if the URI, HTTP version or a header does not fit. 0 on success.
+int chttp_request_from_view(chttp_request *r, const chttp_request_view *v, const char *buf);
+
+// chttp_parser_status
+//   Progress reported by chttp_parser_execute.
+typedef enum
+{
+    CHTTP_PARSER_ERROR = -1,
+    CHTTP_PARSER_NEED_MORE,
+    CHTTP_PARSER_HEADERS_COMPLETE,
+    CHTTP_PARSER_MESSAGE_COMPLETE
+} chttp_parser_status;
+
+// chttp_body_callback
+//   Receives a request body piece by piece as chttp_parser_execute decodes it.
+//
+//   Returns:
+//     Non-zero to stop parsing, which then fails with CHTTP_PARSER_ERROR.
+typedef int (*chttp_body_callback)(void *arg, const char *data, size_t len);
+
+// chttp_parser
+//   Resumable request parser for data that arrives in pieces, e.g. from a
+//   non-blocking socket. The caller appends every chunk it receives to one
+//   buffer and passes the whole buffer back in; the parser remembers how far it
+//   got and never looks at the same byte twice while searching for line ends.
+//   Because the view holds offsets rather than pointers, the caller may
+//   reallocate the buffer between calls. Internal values other than view
+//   should NOT be used.
+typedef struct
+{
+    int state;
+    size_t line;
+    size_t scan;
+    size_t head_length;
+    size_t content_length;
+    int chunked;
+    size_t body_left;
+
+    chttp_body_callback on_body;
+    void *on_body_arg;
+
+    chttp_request_view view;
+} chttp_parser;
+
+// chttp_parser_init
+//   Parameters:
+//     * p - The parser to initialize.
+//
+//   Description:
+//     Resetting a parser so it is ready for the start of a new request. Any
+//     body callback is removed.
+void chttp_parser_init(chttp_parser *p);
+
+// chttp_parser_on_body
+//   Parameters:
+//     * p       - The parser, before its headers are complete.
+//     * on_body - Called with each piece of decoded body.
+//     * arg     - Passed to on_body.
+//
+//   Description:
+//     Streaming the body to a callback instead of collecting it in the
+//     buffer. view.body then stays empty, and chttp_parser_trim can drop bytes
+//     the callback has seen so a large upload never has to be held in memory.
+void chttp_parser_on_body(chttp_parser *p, chttp_body_callback on_body, void *arg);
+
+// chttp_parser_execute
+//   Parameters:
+//     * p   - The parser.
+//     * buf - Every byte received so far for this request.
+//     * len - The number of bytes in buf. Must not shrink between calls.
+//
+//   Description:
+//     Continuing to parse from wherever the previous call stopped. Once the
+//     headers are complete p->view is filled in, and p->view.body covers as
+//     much of the body as has arrived. The body is framed by Content-Length
+//     or by Transfer-Encoding: chunked; chunked bodies are decoded in place,
+//     so the bytes after the head are rewritten and p->view.body is their
+//     contiguous decoded form. Other transfer codings, or Content-Length
+//     alongside Transfer-Encoding, are rejected.
+//
+//   Returns:
+//     CHTTP_PARSER_NEED_MORE until the headers are complete,
+//     CHTTP_PARSER_HEADERS_COMPLETE while the body is still arriving and
+//     CHTTP_PARSER_MESSAGE_COMPLETE once the whole request is in buf.
+//     CHTTP_PARSER_ERROR if the request is malformed or the body callback
+//     asked to stop.
+chttp_parser_status chttp_parser_execute(chttp_parser *p, char *buf, size_t len);
+
+// chttp_parser_trim
+//   Parameters:
+//     * p   - A parser with a body callback.
+//     * buf - The buffer last passed to chttp_parser_execute.
+//     * len - The number of bytes in buf.
+//
+//   Description:
+//     Moving any bytes not yet parsed down over the body bytes already handed
+//     to the body callback. The head, and so p->view, stay where they are.
+//     Does nothing to a parser without a body callback.
+//
+//   Returns:
+//     The new number of bytes in buf, to append further data after.
+size_t chttp_parser_trim(chttp_parser *p, char *buf, size_t len);
+
+// chttp_parser_message_length
+//   Parameters:
+//     * p - A parser that has returned CHTTP_PARSER_MESSAGE_COMPLETE.
+//
+//   Returns:
+//     The number of bytes of the buffer taken up by the request, including
+//     chunk framing. Anything after it belongs to the next request.
+size_t chttp_parser_message_length(const chttp_parser *p);
+
 // chttp_sprint_request
 //   Parameters:
 //     * r      - Request to print.
@@ -266,6 +867,158 @@ size_t chttp_sprint_request(chttp_request *r, char *string, int len);
 //     The number of characters printed into the strong. Returns -1 on failure.
 size_t chttp_sprint_response(chttp_response *r, char *string, int len);
 
+// chttp_sprint_response_head
+//   Parameters:
+//     * r      - Response to print.
+//     * string - Buffer printed to.
+//     * len    - Maximum length of the string.
+//
+//   Description:
+//     Printing the status line and headers of a response, up to and including
+//     the blank line, but not the body. Lets the body be sent separately and
+//     framed by a Content-Length header.
+//
+//   Returns:
+//     The number of characters printed, not counting the terminating NUL.
+//     Returns -1 on failure.
+size_t chttp_sprint_response_head(chttp_response *r, char *string, int len);
+
+// chttp_status_reason
+//   Parameters:
+//     * code - An HTTP status code.
+//
+//   Returns:
+//     The code's reason phrase from the IANA registry, e.g. "Not Found" for
+//     404, or NULL if the code is not registered.
+const char *chttp_status_reason(int code);
+
+// chttp_status_line
+//   Parameters:
+//     * code - An HTTP status code.
+//     * len  - Set to the length of the returned line.
+//
+//   Returns:
+//     The static, NUL-terminated line "HTTP/1.1 <code> <reason>\r\n" for a
+//     registered code, or NULL if the code is not registered.
+const char *chttp_status_line(int code, size_t *len);
+
+// chttp_sprint_status_line
+//   Parameters:
+//     * r      - Response whose status line to print.
+//     * string - Buffer printed to, at least CHTTP_STATUS_LINE_LENGTH long.
+//
+//   Description:
+//     Printing "<version> <code> <reason>\r\n" without going through printf.
+//     An implied status line is copied from chttp_status_line.
+//
+//   Returns:
+//     The number of characters printed, not counting the terminating NUL.
+size_t chttp_sprint_status_line(chttp_response *r, char *string);
+
+// chttp_response_iovcnt
+//   Parameters:
+//     * r - The response.
+//
+//   Returns:
+//     The number of iovecs chttp_iov_response needs for r: one for the status
+//     line, four per header, one for the blank line and one for the body.
+int chttp_response_iovcnt(chttp_response *r);
+
+// chttp_iov_response
+//   Parameters:
+//     * r        - Response to serialize.
+//     * body     - The body, or NULL to serialize only the head.
+//     * body_len - Length of body.
+//     * status   - Buffer of at least CHTTP_STATUS_LINE_LENGTH for the status
+//                  line, used only when it cannot come from
+//                  chttp_status_line.
+//     * iov      - Array filled with the pieces of the response.
+//     * iovcnt   - Length of iov.
+//
+//   Description:
+//     Describing a response as a list of buffers for writev(2). Header names
+//     and values are pointed at where the header set stores them and the body
+//     is pointed at where it lives, so the cost is the same whatever the size
+//     of the body. Unlike chttp_sprint_response nothing follows the body; it
+//     should be framed by a Content-Length header. The pieces are only valid
+//     until r, its header set or body change.
+//
+//   Returns:
+//     The number of iovecs used, or -1 if iovcnt is too small.
+int chttp_iov_response(chttp_response *r, const char *body, size_t body_len, char *status,
+                       struct iovec *iov, int iovcnt);
+
+// chttp_sink
+//   Receives serialized output as a list of buffers, which need only stay valid
+//   for the duration of the call.
+//
+//   Returns:
+//     -1 on error, which the writer passes back to its caller. 0 on success.
+typedef int (*chttp_sink)(void *arg, const struct iovec *iov, int iovcnt);
+
+// chttp_fd_sink
+//   Parameters:
+//     * arg    - A blocking file descriptor cast with (void *)(intptr_t)fd.
+//     * iov    - Buffers to write.
+//     * iovcnt - Number of buffers.
+//
+//   Description:
+//     A chttp_sink writing everything to a file descriptor with writev(2).
+int chttp_fd_sink(void *arg, const struct iovec *iov, int iovcnt);
+
+// chttp_chunked_writer
+//   Writes a response whose length is not known up front, using
+//   Transfer-Encoding: chunked. Every chunk goes to the sink as soon as it is
+//   written, so a client starts receiving a generated response while the rest
+//   is still being produced. Internal values should NOT be used.
+typedef struct
+{
+    chttp_sink sink;
+    void *arg;
+    int done;
+} chttp_chunked_writer;
+
+// chttp_chunked_begin
+//   Parameters:
+//     * w    - The writer to start.
+//     * r    - Response whose head to send. Must not have a Content-Length.
+//     * sink - Where the response goes.
+//     * arg  - Passed to sink.
+//
+//   Description:
+//     Adding "Transfer-Encoding: chunked" to r, unless it already has the
+//     header, and sending its head. r->body is ignored; the body is sent with
+//     chttp_chunked_write.
+//
+//   Returns:
+//     -1 if the header could not be added or the sink failed. 0 on success.
+int chttp_chunked_begin(chttp_chunked_writer *w, chttp_response *r, chttp_sink sink, void *arg);
+
+// chttp_chunked_write
+//   Parameters:
+//     * w    - The writer.
+//     * data - Bytes of the body.
+//     * len  - Number of bytes. Writing nothing is allowed and sends nothing.
+//
+//   Description:
+//     Sending data as one chunk.
+//
+//   Returns:
+//     -1 if the writer has ended or the sink failed. 0 on success.
+int chttp_chunked_write(chttp_chunked_writer *w, const char *data, size_t len);
+
+// chttp_chunked_end
+//   Parameters:
+//     * w        - The writer.
+//     * trailers - Trailer fields to send after the body, or NULL.
+//
+//   Description:
+//     Sending the last, empty chunk and any trailers, ending the response.
+//
+//   Returns:
+//     -1 if the writer had already ended or the sink failed. 0 on success.
+int chttp_chunked_end(chttp_chunked_writer *w, chttp_header_set *trailers);
+
 // chttp_fprint_request
 //   Parameters:
 //     * f - The file to print to.
@@ -300,31 +1053,427 @@ size_t chttp_print_request(chttp_request *r);
 //     Prints a response out to stdout.
 size_t chttp_print_response(chttp_response *r);
 
+// chttp_range
+//   A byte range of a representation, resolved against its size.
+typedef struct
+{
+    size_t start;
+    size_t len;
+} chttp_range;
+
+// chttp_parse_ranges
+//   Parameters:
+//     * value  - A Range header, e.g. "bytes=0-99, -500".
+//     * size   - Size of the representation the ranges apply to.
+//     * ranges - Filled with the satisfiable ranges, in the order given.
+//     * max    - Length of ranges.
+//
+//   Description:
+//     Parsing a Range header. Open-ended and suffix ranges are resolved
+//     against size, and ranges reaching past the end are cut short. Ranges
+//     starting past the end are dropped.
+//
+//   Returns:
+//     The number of satisfiable ranges, 0 if there are none (416 Range Not
+//     Satisfiable), or -1 if the header is malformed, not in bytes or has
+//     more than max ranges, in which case it should be ignored.
+int chttp_parse_ranges(const char *value, size_t size, chttp_range *ranges, int max);
+
+// chttp_etag_match
+//   Parameters:
+//     * list - An If-None-Match or If-Range value: "*" or a list of entity
+//              tags.
+//     * etag - The representation's entity tag, quotes included.
+//     * weak - Non-zero for the weak comparison used by If-None-Match, zero
+//              for the strong one used by If-Range.
+//
+//   Returns:
+//     Non-zero if the list matches etag.
+int chttp_etag_match(const char *list, const char *etag, int weak);
+
+// chttp_parse_http_date
+//   Parameters:
+//     * s - An HTTP date: IMF-fixdate, or the obsolete RFC 850 or asctime
+//           formats.
+//     * t - Set to the time on success.
+//
+//   Returns:
+//     -1 if s is not a date. 0 on success.
+int chttp_parse_http_date(const char *s, time_t *t);
+
+// chttp_uri
+//   The parts of a request target, as spans into it. query and fragment are
+//   NULL when the target has none, as opposed to an empty one after a '?' or
+//   '#'.
+typedef struct
+{
+    const char *path;
+    size_t path_len;
+    const char *query;
+    size_t query_len;
+    const char *fragment;
+    size_t fragment_len;
+} chttp_uri;
+
+// chttp_uri_split
+//   Parameters:
+//     * uri - A request target in origin form ("/a?b") or absolute form
+//             ("http://host/a?b"). Need not be NUL-terminated.
+//     * len - Length of uri.
+//     * u   - Filled with spans into uri.
+//
+//   Description:
+//     Splitting a request target into its path, query and fragment without
+//     copying or decoding anything. The path of an absolute-form target
+//     without one is empty.
+//
+//   Returns:
+//     -1 if uri is empty, in neither form or holds a control character. 0 on
+//     success.
+int chttp_uri_split(const char *uri, size_t len, chttp_uri *u);
+
+// chttp_percent_decode
+//   Parameters:
+//     * dst  - Buffer of at least len bytes for the result. May be src, to
+//              decode in place.
+//     * src  - Percent-encoded bytes.
+//     * len  - Length of src.
+//     * plus - Non-zero to also decode '+' as a space, as in form data.
+//
+//   Description:
+//     Decoding "%XX" escapes. Runs without escapes are found with the
+//     vectorized chttp_scan and copied whole, so a span with none costs one
+//     scan. Nothing is NUL-terminated or allocated.
+//
+//   Returns:
+//     The decoded length, or -1 on a '%' not followed by two hex digits.
+long chttp_percent_decode(char *dst, const char *src, size_t len, int plus);
+
+// chttp_path_normalize
+//   Parameters:
+//     * path - A decoded path starting with '/'.
+//     * len  - Length of path.
+//
+//   Description:
+//     Removing "." and ".." segments and collapsing repeated slashes in place,
+//     in one pass. A trailing slash, or one implied by a final "." or "..",
+//     is kept.
+//
+//   Returns:
+//     The new length, or -1 if path does not start with '/' or a ".." would
+//     climb above the root.
+long chttp_path_normalize(char *path, size_t len);
+
+// chttp_path_clean
+//   Parameters:
+//     * path - An encoded path, as from chttp_uri_split, in a writable
+//              buffer.
+//     * len  - Length of path.
+//
+//   Description:
+//     Percent-decoding and normalizing a path in place. The result starts
+//     with '/', has no NUL bytes and no "." or ".." segments, so it can be
+//     appended to a directory without leaving it.
+//
+//   Returns:
+//     The new length, or -1 if the path is malformed, contains an encoded NUL
+//     or climbs above the root.
+long chttp_path_clean(char *path, size_t len);
+
+// chttp_query_param
+//   One key/value pair of a query string or form body, as spans into it,
+//   still encoded. value is NULL for a key without '=', as opposed to an
+//   empty value after one.
+typedef struct
+{
+    const char *key;
+    size_t key_len;
+    const char *value;
+    size_t value_len;
+} chttp_query_param;
+
+// chttp_query_iter
+//   Position of an iteration over a query string or form body.
+typedef struct
+{
+    const char *s;
+    size_t len;
+    size_t off;
+} chttp_query_iter;
+
+// chttp_query_iter_init
+//   Parameters:
+//     * it  - The iterator.
+//     * s   - A query string, as from chttp_uri_split, or an
+//             application/x-www-form-urlencoded body. Need not be
+//             NUL-terminated, and is never written to.
+//     * len - Length of s.
+void chttp_query_iter_init(chttp_query_iter *it, const char *s, size_t len);
+
+// chttp_query_next
+//   Parameters:
+//     * it - The iterator.
+//     * p  - Filled with the next pair.
+//
+//   Description:
+//     Finding the next '&'-separated pair and splitting it at its first '='.
+//     Nothing is decoded or copied, so a large form costs one scan however
+//     few of its values are used. Empty pairs are skipped.
+//
+//   Returns:
+//     1 if p was filled. 0 at the end.
+int chttp_query_next(chttp_query_iter *it, chttp_query_param *p);
+
+// chttp_query_find
+//   Parameters:
+//     * s   - A query string or form body.
+//     * len - Length of s.
+//     * key - The decoded key to look for.
+//     * p   - Filled with the pair found.
+//
+//   Description:
+//     Finding the first pair with a key, comparing each encoded key against
+//     it while decoding on the fly. Scanning stops at the match.
+//
+//   Returns:
+//     -1 if there is no such key. 0 on success.
+int chttp_query_find(const char *s, size_t len, const char *key, chttp_query_param *p);
+
+// chttp_query_decode
+//   Parameters:
+//     * span    - A key or value from a chttp_query_param.
+//     * len     - Length of span.
+//     * buf     - Buffer for the decoded, NUL-terminated text.
+//     * buf_len - Length of buf, which must exceed len; decoding never
+//                 lengthens a span.
+//
+//   Description:
+//     Decoding a key or value once it is needed, with '+' as a space.
+//
+//   Returns:
+//     The decoded length, or -1 if buf is too short or the span has a
+//     malformed escape.
+long chttp_query_decode(const char *span, size_t len, char *buf, size_t buf_len);
+
 // chttp_uri_suffix
 //   Parameters:
-//     * uri -
-//     * len -
+//     * uri - A URI or file path.
+//     * len - Length of uri.
 //
 //   Description:
-//     Takes a URI and finds its suffix. Used in choosing MIME types.
+//     Takes a URI and finds its suffix, the part after the last dot of its
+//     last path segment. Used in choosing MIME types. A name starting with a
+//     dot, like ".profile", has no suffix.
 //
 //   Returns:
-//     A pointer to the URI where the suffix begins. If the function cannot find
-//     a suffix, it instead returns NULL.
+//     A pointer to the URI where the suffix begins, past the dot. If the
+//     function cannot find a suffix, it instead returns NULL.
 const char *chttp_uri_suffix(const char *uri, size_t len);
 
+// chttp_mime_lookup
+//   Parameters:
+//     * suffix - A suffix as found by chttp_uri_suffix, need not be
+//                NUL-terminated.
+//     * len    - Length of suffix.
+//
+//   Description:
+//     Finding the MIME type for a suffix, ignoring case. Types loaded by
+//     chttp_mime_load are consulted first, then a built-in table of common
+//     types. Nothing is allocated.
+//
+//   Returns:
+//     The type as a string that lives as long as the process, or NULL if the
+//     suffix is unknown.
+const char *chttp_mime_lookup(const char *suffix, size_t len);
+
+// chttp_mime_load
+//   Parameters:
+//     * path - A file in mime.types format: each line a type followed by its
+//              suffixes, with '#' starting a comment.
+//
+//   Description:
+//     Loading MIME types for chttp_mime_lookup into an immutable hash table,
+//     replacing any loaded before. Meant to be called once at startup; the
+//     table is kept for the life of the process.
+//
+//   Returns:
+//     -1 if the file cannot be read or memory runs out. 0 on success.
+int chttp_mime_load(const char *path);
+
 // chttp_uri_mime
 //   Parameters:
-//     * suffix -
-//     * len    -
+//     * suffix     - A suffix as found by chttp_uri_suffix.
+//     * suffix_len - Length of suffix.
+//     * buf        - Buffer the type is written to.
+//     * buf_len    - Length of buf.
 //
 //   Description:
-//     Takes a valid suffix (as generated by chttp_get_suffix), and returns its
-//     appropriate MIME through writing it to buf.
+//     Takes a valid suffix (as generated by chttp_uri_suffix), and returns its
+//     appropriate MIME through writing it to buf. Use chttp_mime_lookup to
+//     avoid the copy.
 //
 //   Returns:
 //     -1 upon error, either through size contraints or suffix being invalid.
 //     0 upon success.
 int chttp_uri_mime(const char *suffix, size_t suffix_len, char *buf, size_t buf_len);
 
+// chttp_route_param
+//   A path parameter captured by a ":name" segment. Both name and value point
+//   into memory that outlives the match, the route's pattern and the path
+//   being matched, and are not NUL-terminated.
+typedef struct
+{
+    const char *name;
+    size_t name_len;
+    const char *value;
+    size_t value_len;
+} chttp_route_param;
+
+typedef struct chttp_route_match chttp_route_match;
+
+// chttp_route_handler
+//   Called for a request matching a route.
+//
+//   Parameters:
+//     * ctx   - Whatever the caller dispatching the request passes, such as the
+//               connection to respond on.
+//     * req   - The request.
+//     * match - The route's data, parameters and, for a mount, the rest of the
+//               path.
+//
+//   Returns:
+//     Whatever the dispatching caller expects, e.g. -1 to drop the connection.
+typedef int (*chttp_route_handler)(void *ctx, chttp_request *req, const chttp_route_match *match);
+
+// chttp_route_match
+//   The result of a chttp_router_match. Nothing in it is allocated. Only allow
+//   is set when no route is found: one bit, 1 << method, for each method the
+//   path's routes take, e.g. for the Allow header of a 405.
+struct chttp_route_match
+{
+    chttp_route_handler handler;
+    void *data;
+    chttp_route_param params[CHTTP_ROUTE_PARAMS];
+    int param_count;
+    const char *rest;
+    size_t rest_len;
+    int allow;
+};
+
+// chttp_route_status
+//   Outcome of matching a request against a router.
+typedef enum
+{
+    CHTTP_ROUTE_NOT_FOUND,
+    CHTTP_ROUTE_METHOD_NOT_ALLOWED,
+    CHTTP_ROUTE_FOUND
+} chttp_route_status;
+
+// CHTTP_ROUTE_ANY
+//   Method for a route that handles every method.
+#define CHTTP_ROUTE_ANY -1
+
+typedef struct chttp_route_node chttp_route_node;
+
+// chttp_router
+//   Maps method and path patterns to handlers with a radix tree of the
+//   patterns' static parts, each edge labelled with the longest run of
+//   characters its patterns share. Meant to be built once at startup and then
+//   only matched against, from any number of threads.
+typedef struct
+{
+    chttp_route_node *root;
+} chttp_router;
+
+// chttp_router_fill
+//   Parameters:
+//     * r - The router to fill.
+//
+//   Returns:
+//     -1 if memory runs out. 0 on success.
+int chttp_router_fill(chttp_router *r);
+
+// chttp_router_add
+//   Parameters:
+//     * r       - The router.
+//     * method  - A chttp_method, or CHTTP_ROUTE_ANY.
+//     * pattern - A path starting with '/', e.g. "/users/:id/posts". A segment
+//                 starting with ':' matches any one non-empty segment and is
+//                 captured under the name that follows. Kept, not copied.
+//     * handler - Called for matching requests.
+//     * data    - Passed to handler through the match.
+//
+//   Description:
+//     Adding a route matching a whole path. Static segments take precedence
+//     over parameters, so "/users/me" wins over "/users/:id".
+//
+//   Returns:
+//     -1 if the pattern is malformed, has too many parameters, names a
+//     parameter differently from a route already registered in the same
+//     place, or duplicates a route; or if memory runs out. 0 on success.
+int chttp_router_add(chttp_router *r, int method, const char *pattern, chttp_route_handler handler, void *data);
+
+// chttp_router_mount
+//   Parameters:
+//     * r       - The router.
+//     * method  - A chttp_method, or CHTTP_ROUTE_ANY.
+//     * prefix  - A path starting with '/' and without parameters, e.g.
+//                 "/static". A trailing '/' is ignored, so "/" mounts on
+//                 every path.
+//     * handler - Called for requests under the prefix.
+//     * data    - Passed to handler through the match.
+//
+//   Description:
+//     Adding a handler for the prefix and every path below it: "/static"
+//     matches "/static" and "/static/app.js" but not "/statics". The rest of
+//     the path, from the '/' after the prefix, is given in the match. Full
+//     routes take precedence over mounts, and longer mounts over shorter.
+//
+//   Returns:
+//     -1 on a malformed or duplicate prefix, or if memory runs out. 0 on
+//     success.
+int chttp_router_mount(chttp_router *r, int method, const char *prefix, chttp_route_handler handler, void *data);
+
+// chttp_router_match
+//   Parameters:
+//     * r      - The router.
+//     * method - The request's method. HEAD falls back to GET routes.
+//     * path   - The request's path, without the query string. Need not be
+//                NUL-terminated.
+//     * len    - Length of path.
+//     * match  - Filled in on success, and its allow otherwise.
+//
+//   Description:
+//     Finding the route for a request without allocating. A static child is
+//     tried before a parameter and abandoned if it leads nowhere, so a path
+//     is walked once when routes do not overlap, but where static and
+//     parameter segments do it can be walked again for each parameter
+//     along the way, up to 2^CHTTP_ROUTE_PARAMS times.
+//
+//   Returns:
+//     CHTTP_ROUTE_FOUND with match filled in, CHTTP_ROUTE_METHOD_NOT_ALLOWED
+//     with match->allow set if routes exist for the path but not for the
+//     method, or CHTTP_ROUTE_NOT_FOUND.
+chttp_route_status chttp_router_match(const chttp_router *r, chttp_method method, const char *path, size_t len,
+                                      chttp_route_match *match);
+
+// chttp_router_free
+//   Parameters:
+//     * r - The router.
+//
+//   Description:
+//     Freeing the tree. Patterns and handler data are the caller's.
+void chttp_router_free(chttp_router *r);
+
+// chttp_route_get_param
+//   Parameters:
+//     * match - A successful match.
+//     * name  - A parameter name, without the ':'.
+//     * len   - Set to the length of the value.
+//
+//   Returns:
+//     The captured value, not NUL-terminated, or NULL if the route has no
+//     such parameter.
+const char *chttp_route_get_param(const chttp_route_match *match, const char *name, size_t *len);
+
 #endif
@@ -2,11 +2,18 @@
 #define _CHTTP_DEFINES_H_
 
 #define CHTTP_METHOD_LENGTH            8
+#define CHTTP_METHOD_NAME_LENGTH      32
+#define CHTTP_METHOD_INTERN_COUNT     64
 #define CHTTP_HEADER_KEY_LENGTH       64
 #define CHTTP_HEADER_VALUE_LENGTH   4096
 #define CHTTP_URI_LENGTH             256
 #define CHTTP_HTTP_VERSION_LENGTH     64
 #define CHTTP_REASON_PHRASE_LENGTH    64
 #define CHTTP_BODY_LENGTH          16384
+#define CHTTP_VIEW_HEADER_COUNT       64
+#define CHTTP_HEADER_BUDGET        65536
+#define CHTTP_ARENA_BLOCK_SIZE     65536
+#define CHTTP_ROUTE_PARAMS             8
+#define CHTTP_STATUS_LINE_LENGTH     (CHTTP_HTTP_VERSION_LENGTH + CHTTP_REASON_PHRASE_LENGTH + 16)
 
 #endif
@@ -0,0 +1,60 @@
+#ifndef _CHTTP_SCAN_H_
+#define _CHTTP_SCAN_H_
+
+#include <stddef.h>
+
+// chttp_scan_impl
+//   Implementations of the delimiter scanner. The best one supported by the
+//   running CPU is picked on first use.
+typedef enum
+{
+    CHTTP_SCAN_SCALAR,
+    CHTTP_SCAN_SSE2,
+    CHTTP_SCAN_AVX2
+} chttp_scan_impl;
+
+// chttp_scan
+//   Parameters:
+//     * buf - The buffer to scan.
+//     * len - The number of bytes in buf.
+//     * a   - First delimiter.
+//     * b   - Second delimiter. Pass a twice to search for a single byte.
+//
+//   Description:
+//     Finding the first byte in buf that is a, b or a character that may not
+//     appear in an HTTP head: any control character other than horizontal tab
+//     (which includes CR and LF), or DEL. Scans 16 or 32 bytes at a time where
+//     the CPU allows it.
+//
+//   Returns:
+//     The offset of the first such byte, or len if there is none.
+size_t chttp_scan(const char *buf, size_t len, char a, char b);
+
+// chttp_scan_scalar
+//   Parameters:
+//     * buf - The buffer to scan.
+//     * len - The number of bytes in buf.
+//     * a   - First delimiter.
+//     * b   - Second delimiter.
+//
+//   Description:
+//     The byte-at-a-time reference version of chttp_scan.
+size_t chttp_scan_scalar(const char *buf, size_t len, char a, char b);
+
+// chttp_scan_select
+//   Parameters:
+//     * impl - The implementation chttp_scan should use from now on.
+//
+//   Description:
+//     Overriding the implementation picked at runtime, e.g. to test each one.
+//
+//   Returns:
+//     -1 if the CPU or the build does not support impl. 0 on success.
+int chttp_scan_select(chttp_scan_impl impl);
+
+// chttp_scan_current
+//   Returns:
+//     The implementation chttp_scan is currently using.
+chttp_scan_impl chttp_scan_current();
+
+#endif
@@ -0,0 +1,157 @@
+#include "chttp.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+// Skipping optional whitespace and list separators.
+static const char *skip_list_space(const char *s)
+{
+    while (*s == ' ' || *s == '\t' || *s == ',')
+        s++;
+    return s;
+}
+
+// Checking an entity tag list against a tag.
+int chttp_etag_match(const char *list, const char *etag, int weak)
+{
+    if (list == NULL || etag == NULL)
+        return 0;
+
+    // Weak comparison ignores the W/ prefix on either side; strong comparison
+    // never matches a weak tag.
+    int etag_weak = strncmp(etag, "W/", 2) == 0;
+    if (etag_weak)
+    {
+        if (!weak)
+            return 0;
+        etag += 2;
+    }
+    size_t etag_len = strlen(etag);
+
+    for (const char *s = skip_list_space(list); *s; s = skip_list_space(s))
+    {
+        if (*s == '*')
+            return 1;
+
+        int tag_weak = strncmp(s, "W/", 2) == 0;
+        if (tag_weak)
+            s += 2;
+        if (*s != '"')
+            return 0;
+
+        const char *end = strchr(s + 1, '"');
+        if (end == NULL)
+            return 0;
+        end++;
+        if ((weak || !tag_weak) && (size_t)(end - s) == etag_len && strncmp(s, etag, etag_len) == 0)
+            return 1;
+        s = end;
+    }
+    return 0;
+}
+
+// Parsing an HTTP date in any of the three formats RFC 9110 requires
+// recipients to accept.
+int chttp_parse_http_date(const char *s, time_t *t)
+{
+    static const char *const formats[] = {
+        "%a, %d %b %Y %H:%M:%S GMT", // IMF-fixdate
+        "%A, %d-%b-%y %H:%M:%S GMT", // RFC 850
+        "%a %b %e %H:%M:%S %Y",      // asctime
+    };
+
+    for (size_t i = 0; i < sizeof(formats) / sizeof(formats[0]); i++)
+    {
+        struct tm tm;
+        memset(&tm, 0, sizeof(tm));
+        const char *end = strptime(s, formats[i], &tm);
+        if (end != NULL && *end == '\0')
+        {
+            *t = timegm(&tm);
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// Parsing an unsigned decimal number, advancing s past it.
+static int parse_offset(const char **s, size_t *out)
+{
+    const char *p = *s;
+    if (*p < '0' || *p > '9')
+        return -1;
+
+    size_t n = 0;
+    for (; *p >= '0' && *p <= '9'; p++)
+    {
+        if (n > ((size_t)-1 - 9) / 10)
+            return -1;
+        n = n * 10 + (*p - '0');
+    }
+    *s = p;
+    *out = n;
+    return 0;
+}
+
+// Parsing a Range header.
+int chttp_parse_ranges(const char *value, size_t size, chttp_range *ranges, int max)
+{
+    if (value == NULL || strncasecmp(value, "bytes=", 6) != 0)
+        return -1;
+
+    int count = 0;
+    int specs = 0;
+    for (const char *s = skip_list_space(value + 6); *s; s = skip_list_space(s))
+    {
+        if (++specs > max)
+            return -1;
+
+        // A suffix range asks for the last n bytes. Either kind is checked
+        // for syntax up to the next comma before it is satisfied or dropped,
+        // so a malformed header is ignored as a whole.
+        size_t first, last, n = 0;
+        int suffix = *s == '-';
+        if (suffix)
+        {
+            s++;
+            if (parse_offset(&s, &n))
+                return -1;
+        } else
+        {
+            if (parse_offset(&s, &first) || *s++ != '-')
+                return -1;
+            if (*s >= '0' && *s <= '9')
+            {
+                if (parse_offset(&s, &last) || last < first)
+                    return -1;
+            } else
+                last = (size_t)-1;
+        }
+
+        while (*s == ' ' || *s == '\t')
+            s++;
+        if (*s != ',' && *s != '\0')
+            return -1;
+
+        if (suffix)
+        {
+            if (n == 0 || size == 0)
+                continue;
+            first = n < size ? size - n : 0;
+            last = size - 1;
+        } else
+        {
+            if (first >= size)
+                continue;
+            if (last >= size)
+                last = size - 1;
+        }
+
+        ranges[count].start = first;
+        ranges[count].len = last - first + 1;
+        count++;
+    }
+
+    return specs == 0 ? -1 : count;
+}
@@ -2,15 +2,133 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+
+// Allocating storage for a header set, from its arena if it has one.
+static void *set_alloc(chttp_header_set *s, size_t len)
+{
+    return s->arena ? chttp_arena_alloc(s->arena, len) : malloc(len);
+}
+
+// Growing storage of a header set. Arena memory cannot grow in place, so the
+// old contents are copied and the old block is left for chttp_arena_reset.
+static void *set_realloc(chttp_header_set *s, void *p, size_t old_len, size_t len)
+{
+    if (!s->arena)
+        return realloc(p, len);
+
+    void *np = chttp_arena_alloc(s->arena, len);
+    if (np != NULL && old_len > 0)
+        memcpy(np, p, old_len);
+    return np;
+}
+
+// Freeing storage of a header set that is not arena-backed.
+static void set_free(chttp_header_set *s, void *p)
+{
+    if (!s->arena)
+        free(p);
+}
+
+// Lower-casing an ASCII character without consulting the locale.
+static inline unsigned char fold(unsigned char c)
+{
+    return c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c;
+}
+
+// Hashing a header name case-insensitively (FNV-1a over folded bytes).
+static unsigned int hash_name(const char *name, size_t len)
+{
+    unsigned int h = 2166136261u;
+    for (size_t i = 0; i < len; i++)
+        h = (h ^ fold((unsigned char)name[i])) * 16777619u;
+    return h;
+}
+
+// Finding the index slot holding the first header with a given name, or the
+// empty slot where it would go.
+static int *index_slot(chttp_header_set *set, const char *name, size_t len, unsigned int hash)
+{
+    int mask = set->index_size - 1;
+    for (int i = hash & mask;; i = (i + 1) & mask)
+    {
+        int *slot = &set->index[i];
+        if (*slot < 0)
+            return slot;
+
+        chttp_header *h = &set->headers[*slot];
+        if (h->hash == hash && h->header_len == len && strncasecmp(set->data + h->header, name, len) == 0)
+            return slot;
+    }
+}
+
+// Linking header i into the index.
+static void index_insert(chttp_header_set *set, int i)
+{
+    chttp_header *h = &set->headers[i];
+    h->next = -1;
+
+    int *slot = index_slot(set, set->data + h->header, h->header_len, h->hash);
+    if (*slot < 0)
+    {
+        *slot = i;
+        return;
+    }
+
+    int last = *slot;
+    while (set->headers[last].next >= 0)
+        last = set->headers[last].next;
+    set->headers[last].next = i;
+}
+
+// Rebuilding the index at a new size, keeping the load factor under one half.
+// Returns -1, with the old index kept, if memory runs out.
+static int index_rebuild(chttp_header_set *set, int index_size)
+{
+    int *index = (int *)set_alloc(set, sizeof(int) * index_size);
+    if (index == NULL)
+        return -1;
+
+    set_free(set, set->index);
+    set->index_size = index_size;
+    set->index = index;
+    memset(set->index, 0xff, sizeof(int) * index_size);
+
+    for (int i = 0; i < set->len; i++)
+        index_insert(set, i);
+    return 0;
+}
+
+// Setting up the parts of a header set that do not need allocating.
+static void set_init(chttp_header_set *s, chttp_arena *a)
+{
+    s->len = 0;
+    s->index_size = 0;
+    s->index = NULL;
+    s->data = NULL;
+    s->data_len = 0;
+    s->data_size = 0;
+    s->budget = CHTTP_HEADER_BUDGET;
+    s->arena = a;
+}
 
 // Filling a header set.
 void chttp_header_set_fill(chttp_header_set *s)
 {
+    set_init(s, NULL);
     s->size = 1;
-    s->len = 0;
     s->headers = (chttp_header *)malloc(sizeof(chttp_header));
 }
 
+// Filling a header set backed by an arena. Starting with room for a typical
+// request's headers saves a few copies while growing.
+void chttp_header_set_arena_fill(chttp_header_set *s, chttp_arena *a)
+{
+    set_init(s, a);
+    s->size = 16;
+    s->headers = (chttp_header *)chttp_arena_alloc(a, sizeof(chttp_header) * s->size);
+}
+
 // Allocating the space for a chttp_header_set.
 chttp_header_set *chttp_header_set_allocate()
 {
@@ -19,36 +137,127 @@ chttp_header_set *chttp_header_set_allocate()
     return hs;
 }
 
+// Allocating a chttp_header_set from an arena.
+chttp_header_set *chttp_header_set_arena_allocate(chttp_arena *a)
+{
+    chttp_header_set *hs = (chttp_header_set *)chttp_arena_alloc(a, sizeof(chttp_header_set));
+    if (hs != NULL)
+        chttp_header_set_arena_fill(hs, a);
+    return hs;
+}
+
 // Freeing a chttp_header_set.
 void chttp_header_set_free(chttp_header_set *s)
 {
+    if (s->arena)
+        return;
+
     free(s->headers);
+    free(s->index);
+    free(s->data);
     free(s);
 }
 
+// Setting the size limit of a header set.
+void chttp_header_set_budget(chttp_header_set *s, size_t budget)
+{
+    s->budget = budget;
+}
+
+// Appending a NUL-terminated copy of str to the set's string storage.
+static unsigned int data_append(chttp_header_set *set, const char *str, size_t len)
+{
+    unsigned int off = set->data_len;
+    memcpy(set->data + off, str, len);
+    set->data[off + len] = '\0';
+    set->data_len += len + 1;
+    return off;
+}
+
 // Adding a header to the header set.
-void chttp_add_header(chttp_header_set *set, const char *header, const char *value)
+int chttp_add_header(chttp_header_set *set, const char *header, const char *value)
+{
+    return chttp_add_header_n(set, header, strlen(header), value, strlen(value));
+}
+
+// Adding a header of known length to the header set.
+int chttp_add_header_n(chttp_header_set *set, const char *header, size_t header_len,
+                       const char *value, size_t value_len)
 {
+    size_t need = header_len + value_len + 2;
+    if (need > set->budget || set->data_len + need > set->budget)
+        return -1;
+
+    // Growing whatever is full before touching anything, so running out of
+    // memory leaves the set as it was, each buffer at its old or new size.
+    if (set->data_len + need > set->data_size)
+    {
+        size_t data_size = set->data_size ? set->data_size : 256;
+        while (data_size < set->data_len + need)
+            data_size *= 2;
+        char *data = (char *)set_realloc(set, set->data, set->data_len, data_size);
+        if (data == NULL)
+            return -1;
+        set->data = data;
+        set->data_size = data_size;
+    }
+
     if (set->len >= set->size)
     {
+        chttp_header *headers = (chttp_header *)set_realloc(set, set->headers, sizeof(chttp_header) * set->len,
+                                                            sizeof(chttp_header) * set->size * 2);
+        if (headers == NULL)
+            return -1;
+        set->headers = headers;
         set->size *= 2;
-        chttp_header *new_headers = (chttp_header *)malloc(sizeof(chttp_header) * set->size);
-        memcpy(new_headers, set->headers, set->len * sizeof(chttp_header));
-        free(set->headers);
-        set->headers = new_headers;
     }
 
-    memset(&set->headers[set->len], 0, sizeof(chttp_header));
-    strncpy(set->headers[set->len].header, header, CHTTP_HEADER_KEY_LENGTH);
-    strncpy(set->headers[set->len].value, value, CHTTP_HEADER_VALUE_LENGTH);
+    if ((set->len + 1) * 2 > set->index_size && index_rebuild(set, set->index_size ? set->index_size * 2 : 8))
+        return -1;
+
+    chttp_header *h = &set->headers[set->len];
+    h->header = data_append(set, header, header_len);
+    h->header_len = header_len;
+    h->value = data_append(set, value, value_len);
+    h->value_len = value_len;
+    h->hash = hash_name(header, header_len);
+    h->id = chttp_header_lookup(header, header_len);
     set->len++;
+    index_insert(set, set->len - 1);
+    return 0;
+}
+
+// Getting the name of a header by position.
+char *chttp_header_key(chttp_header_set *set, int i)
+{
+    return set->data + set->headers[i].header;
+}
+
+// Getting the value of a header by position.
+char *chttp_header_value(chttp_header_set *set, int i)
+{
+    return set->data + set->headers[i].value;
 }
 
 // Getting a header from the header set.
 char *chttp_get_header(chttp_header_set *set, const char *header)
 {
-    for (int i = 0; i < set->len; i++)
-        if (strcmp(header, set->headers[i].header) == 0)
-            return set->headers[i].value;
-    return NULL;
+    int it = -1;
+    return chttp_get_header_next(set, header, &it);
+}
+
+// Getting the next value of a repeated header.
+char *chttp_get_header_next(chttp_header_set *set, const char *header, int *it)
+{
+    if (*it >= 0)
+        *it = set->headers[*it].next;
+    else if (set->index_size > 0)
+    {
+        size_t len = strlen(header);
+        *it = *index_slot(set, header, len, hash_name(header, len));
+    }
+
+    if (*it < 0)
+        return NULL;
+    return set->data + set->headers[*it].value;
 }
@@ -2,6 +2,9 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
 
 // Filling a request.
 void chttp_request_fill(chttp_request *r)
@@ -18,10 +21,25 @@ chttp_request *chttp_request_allocate()
     return r;
 }
 
+// Allocating a chttp_request from an arena.
+chttp_request *chttp_request_arena_allocate(chttp_arena *a)
+{
+    chttp_request *r = (chttp_request *)chttp_arena_alloc(a, sizeof(chttp_request));
+    if (r == NULL)
+        return NULL;
+
+    memset(r, 0, sizeof(chttp_request));
+    r->headers = chttp_header_set_arena_allocate(a);
+    return r->headers ? r : NULL;
+}
+
 // Freeing a chttp_request.
 void chttp_request_free(chttp_request *r)
 {
+    if (r->headers->arena)
+        return;
     chttp_header_set_free(r->headers);
+    free(r->body_storage);
     free(r);
 }
 
@@ -40,9 +58,36 @@ chttp_response *chttp_response_allocate()
     return r;
 }
 
+// Allocating a chttp_response from an arena.
+chttp_response *chttp_response_arena_allocate(chttp_arena *a)
+{
+    chttp_response *r = (chttp_response *)chttp_arena_alloc(a, sizeof(chttp_response));
+    if (r == NULL)
+        return NULL;
+
+    memset(r, 0, sizeof(chttp_response));
+    r->headers = chttp_header_set_arena_allocate(a);
+    return r->headers ? r : NULL;
+}
+
 // Freeing a chttp_response.
 void chttp_response_free(chttp_response *r)
 {
+    if (r->headers->arena)
+        return;
     chttp_header_set_free(r->headers);
+    free(r->body_storage);
     free(r);
 }
+
+// Reading a body from a file descriptor.
+long chttp_fd_producer(void *arg, char *buf, size_t len)
+{
+    int fd = (int)(intptr_t)arg;
+    while (1)
+    {
+        ssize_t n = read(fd, buf, len);
+        if (n >= 0 || errno != EINTR)
+            return n;
+    }
+}
@@ -1,36 +1,317 @@
 #include "chttp.h"
 
-// TODO
-
-// chttp_uri_suffix
-//   Parameters:
-//     * uri -
-//     * len -
-//
-//   Description:
-//     Takes a URI and finds its suffix. Used in choosing MIME types.
-//
-//   Returns:
-//     A pointer to the URI where the suffix begins. If the function cannot find
-//     a suffix, it instead returns NULL.
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+// An extension and the MIME type it maps to.
+typedef struct
+{
+    const char *ext;
+    const char *type;
+} mime_entry;
+
+// Built-in types, sorted by extension for a binary search. Extensions are
+// lower case.
+static const mime_entry mime_builtin[] = {
+    { "7z",           "application/x-7z-compressed" },
+    { "aac",          "audio/aac" },
+    { "apng",         "image/apng" },
+    { "atom",         "application/atom+xml" },
+    { "avi",          "video/x-msvideo" },
+    { "avif",         "image/avif" },
+    { "bin",          "application/octet-stream" },
+    { "bmp",          "image/bmp" },
+    { "bz2",          "application/x-bzip2" },
+    { "c",            "text/x-c" },
+    { "css",          "text/css" },
+    { "csv",          "text/csv" },
+    { "doc",          "application/msword" },
+    { "docx",         "application/vnd.openxmlformats-officedocument.wordprocessingml.document" },
+    { "eot",          "application/vnd.ms-fontobject" },
+    { "epub",         "application/epub+zip" },
+    { "flac",         "audio/flac" },
+    { "gif",          "image/gif" },
+    { "gz",           "application/gzip" },
+    { "h",            "text/x-c" },
+    { "htm",          "text/html" },
+    { "html",         "text/html" },
+    { "ico",          "image/vnd.microsoft.icon" },
+    { "ics",          "text/calendar" },
+    { "jar",          "application/java-archive" },
+    { "jpeg",         "image/jpeg" },
+    { "jpg",          "image/jpeg" },
+    { "js",           "text/javascript" },
+    { "json",         "application/json" },
+    { "jsonld",       "application/ld+json" },
+    { "m4a",          "audio/mp4" },
+    { "m4v",          "video/mp4" },
+    { "map",          "application/json" },
+    { "md",           "text/markdown" },
+    { "mjs",          "text/javascript" },
+    { "mkv",          "video/x-matroska" },
+    { "mov",          "video/quicktime" },
+    { "mp3",          "audio/mpeg" },
+    { "mp4",          "video/mp4" },
+    { "mpeg",         "video/mpeg" },
+    { "odt",          "application/vnd.oasis.opendocument.text" },
+    { "oga",          "audio/ogg" },
+    { "ogg",          "audio/ogg" },
+    { "ogv",          "video/ogg" },
+    { "opus",         "audio/opus" },
+    { "otf",          "font/otf" },
+    { "pdf",          "application/pdf" },
+    { "png",          "image/png" },
+    { "ppt",          "application/vnd.ms-powerpoint" },
+    { "pptx",         "application/vnd.openxmlformats-officedocument.presentationml.presentation" },
+    { "rar",          "application/vnd.rar" },
+    { "rss",          "application/rss+xml" },
+    { "rtf",          "application/rtf" },
+    { "sh",           "application/x-sh" },
+    { "svg",          "image/svg+xml" },
+    { "tar",          "application/x-tar" },
+    { "tif",          "image/tiff" },
+    { "tiff",         "image/tiff" },
+    { "ttf",          "font/ttf" },
+    { "txt",          "text/plain" },
+    { "vtt",          "text/vtt" },
+    { "wasm",         "application/wasm" },
+    { "wav",          "audio/wav" },
+    { "webm",         "video/webm" },
+    { "webmanifest",  "application/manifest+json" },
+    { "webp",         "image/webp" },
+    { "woff",         "font/woff" },
+    { "woff2",        "font/woff2" },
+    { "xhtml",        "application/xhtml+xml" },
+    { "xls",          "application/vnd.ms-excel" },
+    { "xlsx",         "application/vnd.openxmlformats-officedocument.spreadsheetml.sheet" },
+    { "xml",          "application/xml" },
+    { "yaml",         "application/yaml" },
+    { "yml",          "application/yaml" },
+    { "zip",          "application/zip" },
+};
+
+// Lower-casing an ASCII character without consulting the locale.
+static inline unsigned char fold(unsigned char c)
+{
+    return c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c;
+}
+
+// Ordering an extension against a lower-case table key, ignoring the
+// extension's case.
+static int compare_ext(const char *ext, size_t len, const char *key)
+{
+    for (size_t i = 0; i < len; i++)
+    {
+        if (key[i] == '\0')
+            return 1;
+        int d = (int)fold((unsigned char)ext[i]) - (int)(unsigned char)key[i];
+        if (d != 0)
+            return d;
+    }
+    return key[len] == '\0' ? 0 : -1;
+}
+
+// Looking an extension up in the built-in table.
+static const char *builtin_lookup(const char *ext, size_t len)
+{
+    size_t lo = 0;
+    size_t hi = sizeof(mime_builtin) / sizeof(mime_builtin[0]);
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        int d = compare_ext(ext, len, mime_builtin[mid].ext);
+        if (d == 0)
+            return mime_builtin[mid].type;
+        if (d < 0)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+    return NULL;
+}
+
+// Types loaded from a mime.types file. The slots point into the file's text,
+// and none of it is changed or freed once published.
+typedef struct
+{
+    size_t mask;
+    mime_entry *slots;
+    char *text;
+} mime_table;
+
+static _Atomic(mime_table *) mime_loaded;
+
+// Hashing an extension case-insensitively (FNV-1a over folded bytes).
+static unsigned int hash_ext(const char *ext, size_t len)
+{
+    unsigned int h = 2166136261u;
+    for (size_t i = 0; i < len; i++)
+        h = (h ^ fold((unsigned char)ext[i])) * 16777619u;
+    return h;
+}
+
+// Finding the slot for an extension in a loaded table, or the empty slot
+// where it would go.
+static mime_entry *table_slot(const mime_table *t, const char *ext, size_t len)
+{
+    for (size_t i = hash_ext(ext, len) & t->mask;; i = (i + 1) & t->mask)
+    {
+        mime_entry *e = &t->slots[i];
+        if (e->ext == NULL || (strncasecmp(e->ext, ext, len) == 0 && e->ext[len] == '\0'))
+            return e;
+    }
+}
+
+// Whether a character separates tokens in a mime.types file.
+static inline int is_space(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+// Walking the tokens of a mime.types file: each line is a type followed by
+// its extensions, and a '#' starts a comment running to the end of the line.
+// With a table, tokens are NUL-terminated in place, which needs one byte after
+// the text, and every extension goes into the table. Returns the number of
+// extensions seen.
+static size_t parse_types(char *text, size_t len, mime_table *t)
+{
+    size_t count = 0;
+    const char *type = NULL;
+    size_t i = 0;
+    while (i < len)
+    {
+        if (text[i] == '\n')
+            type = NULL;
+        if (is_space(text[i]))
+        {
+            i++;
+            continue;
+        }
+        if (text[i] == '#')
+        {
+            while (i < len && text[i] != '\n')
+                i++;
+            continue;
+        }
+
+        char *token = text + i;
+        while (i < len && !is_space(text[i]))
+            i++;
+        size_t token_len = text + i - token;
+        int line_end = i == len || text[i] == '\n';
+
+        if (type == NULL)
+            type = token;
+        else
+        {
+            // The first mapping given for an extension wins.
+            count++;
+            mime_entry *e = t ? table_slot(t, token, token_len) : NULL;
+            if (e != NULL && e->ext == NULL)
+            {
+                e->ext = token;
+                e->type = type;
+            }
+        }
+
+        if (t != NULL)
+            token[token_len] = '\0';
+        i++;
+        if (line_end)
+            type = NULL;
+    }
+    return count;
+}
+
+// Loading MIME types from a file.
+int chttp_mime_load(const char *path)
+{
+    FILE *f = fopen(path, "r");
+    if (f == NULL)
+        return -1;
+
+    long len = -1;
+    if (fseek(f, 0, SEEK_END) == 0)
+        len = ftell(f);
+    char *text = len >= 0 && fseek(f, 0, SEEK_SET) == 0 ? (char *)malloc(len + 1) : NULL;
+    if (text == NULL || fread(text, sizeof(char), len, f) != (size_t)len)
+    {
+        free(text);
+        fclose(f);
+        return -1;
+    }
+    fclose(f);
+
+    size_t count = parse_types(text, len, NULL);
+    size_t size = 16;
+    while (size < count * 2)
+        size *= 2;
+
+    mime_table *t = (mime_table *)calloc(1, sizeof(mime_table) + sizeof(mime_entry) * size);
+    if (t == NULL)
+    {
+        free(text);
+        return -1;
+    }
+    t->mask = size - 1;
+    t->slots = (mime_entry *)(t + 1);
+    t->text = text;
+    parse_types(text, len, t);
+
+    // A table replaced by a later load is not freed, since lookups on other
+    // threads may still be reading it or holding its strings.
+    atomic_store_explicit(&mime_loaded, t, memory_order_release);
+    return 0;
+}
+
+// Finding the MIME type of an extension.
+const char *chttp_mime_lookup(const char *ext, size_t len)
+{
+    if (len == 0)
+        return NULL;
+
+    const mime_table *t = atomic_load_explicit(&mime_loaded, memory_order_acquire);
+    if (t != NULL)
+    {
+        const mime_entry *e = table_slot(t, ext, len);
+        if (e->ext != NULL)
+            return e->type;
+    }
+    return builtin_lookup(ext, len);
+}
+
+// Finding the suffix of a URI.
 const char *chttp_uri_suffix(const char *uri, size_t len)
 {
+    // Only the last path segment counts, and a leading dot names a hidden
+    // file rather than starting a suffix.
+    for (size_t i = len; i > 0; i--)
+    {
+        char c = uri[i - 1];
+        if (c == '/')
+            return NULL;
+        if (c == '.')
+        {
+            if (i == len || i == 1 || uri[i - 2] == '/')
+                return NULL;
+            return uri + i;
+        }
+    }
     return NULL;
 }
 
-// chttp_uri_mime
-//   Parameters:
-//     * suffix -
-//     * len    -
-//
-//   Description:
-//     Takes a valid suffix (as generated by chttp_get_suffix), and returns its
-//     appropriate MIME through writing it to buf.
-//
-//   Returns:
-//     -1 upon error, either through size contraints or suffix being invalid.
-//     0 upon success.
+// Writing the MIME type of a suffix to a buffer.
 int chttp_uri_mime(const char *suffix, size_t suffix_len, char *buf, size_t buf_len)
 {
-    return -1;
+    const char *type = chttp_mime_lookup(suffix, suffix_len);
+    if (type == NULL)
+        return -1;
+
+    size_t len = strlen(type);
+    if (len >= buf_len)
+        return -1;
+    memcpy(buf, type, len + 1);
+    return 0;
 }
@@ -0,0 +1,274 @@
+#include "chttp.h"
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+// Loading a token of up to eight bytes into one zero-padded word, so it can be
+// compared against a method name with a single integer comparison.
+static inline uint64_t load_word(const char *s, size_t len)
+{
+    uint64_t w = 0;
+    memcpy(&w, s, len);
+    return w;
+}
+
+#define METHOD_WORD(name) load_word(name, sizeof(name) - 1)
+
+// Recognizing a standard method by its length and then its bytes as one word.
+chttp_method chttp_method_lookup(const char *name, size_t len)
+{
+    if (len < 3 || len > 7)
+        return OTHER;
+
+    uint64_t w = load_word(name, len);
+    switch (len)
+    {
+    case 3:
+        if (w == METHOD_WORD("GET")) return GET;
+        if (w == METHOD_WORD("PUT")) return PUT;
+        break;
+    case 4:
+        if (w == METHOD_WORD("POST")) return POST;
+        if (w == METHOD_WORD("HEAD")) return HEAD;
+        break;
+    case 5:
+        if (w == METHOD_WORD("PATCH")) return PATCH;
+        if (w == METHOD_WORD("TRACE")) return TRACE;
+        break;
+    case 6:
+        if (w == METHOD_WORD("DELETE")) return DELETE;
+        break;
+    case 7:
+        if (w == METHOD_WORD("OPTIONS")) return OPTIONS;
+        if (w == METHOD_WORD("CONNECT")) return CONNECT;
+        break;
+    }
+    return OTHER;
+}
+
+#undef METHOD_WORD
+
+static const char *const method_names[] = {
+    [OPTIONS] = "OPTIONS",
+    [GET]     = "GET",
+    [HEAD]    = "HEAD",
+    [POST]    = "POST",
+    [PUT]     = "PUT",
+    [DELETE]  = "DELETE",
+    [TRACE]   = "TRACE",
+    [CONNECT] = "CONNECT",
+    [PATCH]   = "PATCH",
+    [OTHER]   = "OTHER",
+};
+
+// Getting the name of a method.
+const char *chttp_method_name(chttp_method method)
+{
+    if ((unsigned)method > OTHER)
+        return NULL;
+    return method_names[method];
+}
+
+// Extension methods registered so far. Slots are claimed with a
+// compare-and-swap and never released, so readers need no lock. Only
+// chttp_method_register adds to the table, never request input.
+static _Atomic(char *) interned[CHTTP_METHOD_INTERN_COUNT];
+
+// Registering an extension method.
+const char *chttp_method_register(const char *name)
+{
+    size_t len = strlen(name);
+    chttp_method m = chttp_method_lookup(name, len);
+    if (m != OTHER)
+        return method_names[m];
+    if (len == 0 || len >= CHTTP_METHOD_NAME_LENGTH)
+        return NULL;
+
+    char *copy = NULL;
+    for (int i = 0; i < CHTTP_METHOD_INTERN_COUNT; i++)
+    {
+        char *s = atomic_load_explicit(&interned[i], memory_order_acquire);
+        if (s == NULL)
+        {
+            if (copy == NULL)
+            {
+                copy = (char *)malloc(len + 1);
+                if (copy == NULL)
+                    return NULL;
+                memcpy(copy, name, len + 1);
+            }
+
+            // Another thread may have claimed the slot first, in which case
+            // its token is compared like any other.
+            if (atomic_compare_exchange_strong_explicit(&interned[i], &s, copy, memory_order_acq_rel,
+                                                        memory_order_acquire))
+                return copy;
+        }
+
+        if (strcmp(s, name) == 0)
+        {
+            free(copy);
+            return s;
+        }
+    }
+
+    free(copy);
+    return NULL;
+}
+
+// Finding the interned copy of a method token.
+const char *chttp_method_intern(const char *name, size_t len)
+{
+    chttp_method m = chttp_method_lookup(name, len);
+    if (m != OTHER)
+        return method_names[m];
+
+    // Slots fill in order, so the first empty one ends the search.
+    for (int i = 0; i < CHTTP_METHOD_INTERN_COUNT; i++)
+    {
+        const char *s = atomic_load_explicit(&interned[i], memory_order_acquire);
+        if (s == NULL)
+            break;
+        if (strncmp(s, name, len) == 0 && s[len] == '\0')
+            return s;
+    }
+    return NULL;
+}
+
+static const char *const header_names[CHTTP_HEADER_COUNT] = {
+    [CHTTP_HEADER_ACCEPT] = "Accept",
+    [CHTTP_HEADER_ACCEPT_CHARSET] = "Accept-Charset",
+    [CHTTP_HEADER_ACCEPT_ENCODING] = "Accept-Encoding",
+    [CHTTP_HEADER_ACCEPT_LANGUAGE] = "Accept-Language",
+    [CHTTP_HEADER_ACCEPT_RANGES] = "Accept-Ranges",
+    [CHTTP_HEADER_AGE] = "Age",
+    [CHTTP_HEADER_ALLOW] = "Allow",
+    [CHTTP_HEADER_AUTHORIZATION] = "Authorization",
+    [CHTTP_HEADER_CACHE_CONTROL] = "Cache-Control",
+    [CHTTP_HEADER_CONNECTION] = "Connection",
+    [CHTTP_HEADER_CONTENT_DISPOSITION] = "Content-Disposition",
+    [CHTTP_HEADER_CONTENT_ENCODING] = "Content-Encoding",
+    [CHTTP_HEADER_CONTENT_LANGUAGE] = "Content-Language",
+    [CHTTP_HEADER_CONTENT_LENGTH] = "Content-Length",
+    [CHTTP_HEADER_CONTENT_LOCATION] = "Content-Location",
+    [CHTTP_HEADER_CONTENT_RANGE] = "Content-Range",
+    [CHTTP_HEADER_CONTENT_TYPE] = "Content-Type",
+    [CHTTP_HEADER_COOKIE] = "Cookie",
+    [CHTTP_HEADER_DATE] = "Date",
+    [CHTTP_HEADER_ETAG] = "ETag",
+    [CHTTP_HEADER_EXPECT] = "Expect",
+    [CHTTP_HEADER_EXPIRES] = "Expires",
+    [CHTTP_HEADER_FORWARDED] = "Forwarded",
+    [CHTTP_HEADER_FROM] = "From",
+    [CHTTP_HEADER_HOST] = "Host",
+    [CHTTP_HEADER_IF_MATCH] = "If-Match",
+    [CHTTP_HEADER_IF_MODIFIED_SINCE] = "If-Modified-Since",
+    [CHTTP_HEADER_IF_NONE_MATCH] = "If-None-Match",
+    [CHTTP_HEADER_IF_RANGE] = "If-Range",
+    [CHTTP_HEADER_IF_UNMODIFIED_SINCE] = "If-Unmodified-Since",
+    [CHTTP_HEADER_KEEP_ALIVE] = "Keep-Alive",
+    [CHTTP_HEADER_LAST_MODIFIED] = "Last-Modified",
+    [CHTTP_HEADER_LOCATION] = "Location",
+    [CHTTP_HEADER_ORIGIN] = "Origin",
+    [CHTTP_HEADER_PRAGMA] = "Pragma",
+    [CHTTP_HEADER_RANGE] = "Range",
+    [CHTTP_HEADER_REFERER] = "Referer",
+    [CHTTP_HEADER_RETRY_AFTER] = "Retry-After",
+    [CHTTP_HEADER_SERVER] = "Server",
+    [CHTTP_HEADER_SET_COOKIE] = "Set-Cookie",
+    [CHTTP_HEADER_TE] = "TE",
+    [CHTTP_HEADER_TRAILER] = "Trailer",
+    [CHTTP_HEADER_TRANSFER_ENCODING] = "Transfer-Encoding",
+    [CHTTP_HEADER_UPGRADE] = "Upgrade",
+    [CHTTP_HEADER_USER_AGENT] = "User-Agent",
+    [CHTTP_HEADER_VARY] = "Vary",
+    [CHTTP_HEADER_VIA] = "Via",
+    [CHTTP_HEADER_WWW_AUTHENTICATE] = "WWW-Authenticate",
+    [CHTTP_HEADER_X_FORWARDED_FOR] = "X-Forwarded-For",
+};
+
+// Perfect hash of the names above, found offline: no two of them share a slot,
+// so a lookup costs one hash and at most one comparison. A name added to the
+// list needs a new set of multipliers if it collides.
+static inline unsigned header_hash(const char *name, size_t len)
+{
+    unsigned first = (unsigned char)name[0] | 0x20;
+    unsigned last = (unsigned char)name[len - 1] | 0x20;
+    return (first * 26 + last * 9 + (unsigned)len * 8) & 127;
+}
+
+static const unsigned char header_table[128] = {
+    [1] = CHTTP_HEADER_ETAG,
+    [2] = CHTTP_HEADER_TRAILER,
+    [3] = CHTTP_HEADER_CONTENT_RANGE,
+    [4] = CHTTP_HEADER_CONTENT_DISPOSITION,
+    [5] = CHTTP_HEADER_EXPIRES,
+    [6] = CHTTP_HEADER_EXPECT,
+    [11] = CHTTP_HEADER_SET_COOKIE,
+    [18] = CHTTP_HEADER_IF_MATCH,
+    [22] = CHTTP_HEADER_LOCATION,
+    [27] = CHTTP_HEADER_CONTENT_LANGUAGE,
+    [30] = CHTTP_HEADER_ACCEPT,
+    [32] = CHTTP_HEADER_AUTHORIZATION,
+    [35] = CHTTP_HEADER_WWW_AUTHENTICATE,
+    [38] = CHTTP_HEADER_CONTENT_LENGTH,
+    [39] = CHTTP_HEADER_UPGRADE,
+    [40] = CHTTP_HEADER_FORWARDED,
+    [42] = CHTTP_HEADER_X_FORWARDED_FOR,
+    [45] = CHTTP_HEADER_CONTENT_ENCODING,
+    [49] = CHTTP_HEADER_ALLOW,
+    [58] = CHTTP_HEADER_IF_NONE_MATCH,
+    [59] = CHTTP_HEADER_KEEP_ALIVE,
+    [60] = CHTTP_HEADER_CONNECTION,
+    [63] = CHTTP_HEADER_IF_MODIFIED_SINCE,
+    [66] = CHTTP_HEADER_CACHE_CONTROL,
+    [68] = CHTTP_HEADER_HOST,
+    [70] = CHTTP_HEADER_USER_AGENT,
+    [73] = CHTTP_HEADER_RANGE,
+    [75] = CHTTP_HEADER_COOKIE,
+    [77] = CHTTP_HEADER_ACCEPT_RANGES,
+    [78] = CHTTP_HEADER_REFERER,
+    [79] = CHTTP_HEADER_IF_UNMODIFIED_SINCE,
+    [81] = CHTTP_HEADER_FROM,
+    [84] = CHTTP_HEADER_ORIGIN,
+    [85] = CHTTP_HEADER_DATE,
+    [93] = CHTTP_HEADER_VARY,
+    [94] = CHTTP_HEADER_ACCEPT_CHARSET,
+    [95] = CHTTP_HEADER_ACCEPT_LANGUAGE,
+    [96] = CHTTP_HEADER_SERVER,
+    [100] = CHTTP_HEADER_LAST_MODIFIED,
+    [101] = CHTTP_HEADER_TE,
+    [108] = CHTTP_HEADER_CONTENT_LOCATION,
+    [110] = CHTTP_HEADER_RETRY_AFTER,
+    [111] = CHTTP_HEADER_TRANSFER_ENCODING,
+    [113] = CHTTP_HEADER_ACCEPT_ENCODING,
+    [119] = CHTTP_HEADER_IF_RANGE,
+    [121] = CHTTP_HEADER_PRAGMA,
+    [123] = CHTTP_HEADER_CONTENT_TYPE,
+    [125] = CHTTP_HEADER_VIA,
+    [127] = CHTTP_HEADER_AGE,
+};
+
+// Recognizing a well-known header name, ignoring case.
+chttp_header_id chttp_header_lookup(const char *name, size_t len)
+{
+    if (len == 0)
+        return CHTTP_HEADER_UNKNOWN;
+
+    chttp_header_id id = (chttp_header_id)header_table[header_hash(name, len)];
+    const char *known = header_names[id];
+    if (id == CHTTP_HEADER_UNKNOWN || strlen(known) != len || strncasecmp(known, name, len) != 0)
+        return CHTTP_HEADER_UNKNOWN;
+    return id;
+}
+
+// Getting the canonical spelling of a well-known header.
+const char *chttp_header_name(chttp_header_id id)
+{
+    if (id <= CHTTP_HEADER_UNKNOWN || id >= CHTTP_HEADER_COUNT)
+        return NULL;
+    return header_names[id];
+}
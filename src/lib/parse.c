@@ -1,131 +1,682 @@
 #include "chttp.h"
 
+#include <stdlib.h>
 #include <string.h>
-#include <ctype.h>
+#include <strings.h>
 
 #include "chttp_fmemopen.h"
+#include "chttp_scan.h"
 
-// Filling a token like fill_token, only that it also sets the value in bk to
-// determine whether or not there is a break in the message (\r\n\r\n). If bk
-// is null, functions exactly like fill_token (only that it breaks on \r\n\r\n).
-static size_t fill_tokenb(FILE *f, char *buf, size_t len, int *bk)
-{
-    if (bk != NULL)
-        *bk = 0;
-
-    int c;
-    while (isspace(c = fgetc(f)) && !feof(f)) { }
-    ungetc(c, f);
-
-    size_t i;
-    int mode = 0;
-    for (i = 0; i < (len - 1) && (c = fgetc(f)) > 0; i++)
-    {
-        if (mode == 0 && c == 13)
-            mode = 1;
-        else if (mode == 1 && c == 10)
-            mode = 2;
-        else if (mode == 2 && c == 13)
-            mode = 3;
-        else if (mode == 3 && c == 10)
-        {
-            if (bk != NULL)
-                *bk = 1;
+// Splitting a request line into its method, URI and version spans.
+static int parse_request_line(chttp_request_view *v, const char *buf, size_t start, size_t end)
+{
+    size_t sp1 = start + chttp_scan(buf + start, end - start, ' ', ' ');
+    if (sp1 == start || sp1 == end)
+        return -1;
+
+    size_t uri = sp1 + 1;
+    size_t sp2 = uri + chttp_scan(buf + uri, end - uri, ' ', ' ');
+    if (sp2 == uri || sp2 == end || sp2 + 1 == end)
+        return -1;
+
+    v->method_name.off = start;
+    v->method_name.len = sp1 - start;
+    v->uri.off = uri;
+    v->uri.len = sp2 - uri;
+    v->http_version.off = sp2 + 1;
+    v->http_version.len = end - v->http_version.off;
+    v->method = chttp_method_lookup(buf + start, v->method_name.len);
+    return 0;
+}
+
+// Splitting a header line into name and value spans, trimming optional
+// whitespace around the value.
+static int parse_header_line(chttp_request_view *v, const char *buf, size_t start, size_t end)
+{
+    if (v->header_count >= CHTTP_VIEW_HEADER_COUNT)
+        return -1;
+
+    // Whitespace is not allowed between the name and the colon.
+    size_t name_end = start + chttp_scan(buf + start, end - start, ':', ' ');
+    if (name_end == start || name_end == end || buf[name_end] != ':')
+        return -1;
+    if (memchr(buf + start, '\t', name_end - start) != NULL)
+        return -1;
+
+    size_t value = name_end + 1;
+    while (value < end && (buf[value] == ' ' || buf[value] == '\t'))
+        value++;
+    while (end > value && (buf[end - 1] == ' ' || buf[end - 1] == '\t'))
+        end--;
+
+    chttp_span_header *h = &v->headers[v->header_count++];
+    h->name.off = start;
+    h->name.len = name_end - start;
+    h->value.off = value;
+    h->value.len = end - value;
+    h->id = chttp_header_lookup(buf + start, h->name.len);
+    return 0;
+}
+
+enum
+{
+    PARSER_REQUEST_LINE,
+    PARSER_HEADERS,
+    PARSER_BODY,
+    PARSER_CHUNK_SIZE,
+    PARSER_CHUNK_DATA,
+    PARSER_CHUNK_END,
+    PARSER_TRAILERS,
+    PARSER_DONE
+};
+
+// Parsing a Content-Length value. Returns -1 if it is not a plain decimal
+// number.
+static int parse_content_length(const char *s, size_t len, size_t *out)
+{
+    if (len == 0)
+        return -1;
+
+    size_t n = 0;
+    for (size_t i = 0; i < len; i++)
+    {
+        if (s[i] < '0' || s[i] > '9')
+            return -1;
+        if (n > ((size_t)-1 - 9) / 10)
+            return -1;
+        n = n * 10 + (s[i] - '0');
+    }
+
+    *out = n;
+    return 0;
+}
+
+// Parsing the size at the start of a chunk-size line, ignoring any chunk
+// extensions after it. Returns -1 if there is no hexadecimal size or it would
+// overflow.
+static int parse_chunk_size(const char *s, size_t len, size_t *out)
+{
+    size_t n = 0;
+    size_t i = 0;
+    for (; i < len; i++)
+    {
+        int d;
+        if (s[i] >= '0' && s[i] <= '9')
+            d = s[i] - '0';
+        else if (s[i] >= 'a' && s[i] <= 'f')
+            d = s[i] - 'a' + 10;
+        else if (s[i] >= 'A' && s[i] <= 'F')
+            d = s[i] - 'A' + 10;
+        else
             break;
-        } else if (isspace(c))
+        if (n > ((size_t)-1 >> 4))
+            return -1;
+        n = (n << 4) | d;
+    }
+    if (i == 0)
+        return -1;
+
+    while (i < len && (s[i] == ' ' || s[i] == '\t'))
+        i++;
+    if (i < len && s[i] != ';')
+        return -1;
+
+    *out = n;
+    return 0;
+}
+
+// Deciding how the body is framed once the headers are complete.
+static int parser_frame_body(chttp_parser *p, const char *buf)
+{
+    chttp_request_view *v = &p->view;
+    p->content_length = 0;
+    p->chunked = 0;
+
+    int transfer_encodings = 0;
+    int content_lengths = 0;
+    for (int i = 0; i < v->header_count; i++)
+    {
+        chttp_span_header *h = &v->headers[i];
+        size_t n;
+        switch (h->id)
         {
-            ungetc(c, f);
+        case CHTTP_HEADER_TRANSFER_ENCODING:
+            // Only a plain chunked coding is understood.
+            if (h->value.len != 7 || strncasecmp(buf + h->value.off, "chunked", 7) != 0)
+                return -1;
+            transfer_encodings++;
+            break;
+
+        case CHTTP_HEADER_CONTENT_LENGTH:
+            if (parse_content_length(buf + h->value.off, h->value.len, &n))
+                return -1;
+            if (content_lengths++ > 0 && n != p->content_length)
+                return -1;
+            p->content_length = n;
+            break;
+
+        default:
             break;
+        }
+    }
+
+    // Sending Content-Length alongside Transfer-Encoding is a classic request
+    // smuggling trick, so it is refused, as is repeating Transfer-Encoding.
+    if (transfer_encodings > 0)
+    {
+        if (transfer_encodings > 1 || content_lengths > 0)
+            return -1;
+        p->content_length = 0;
+        p->chunked = 1;
+    }
+    return 0;
+}
+
+// Finding the end of the line starting at p->line, resuming the search at
+// p->scan. Returns 1 and the line's bounds once it is complete, 0 if more data
+// is needed and -1 on a bare CR or a stray control character.
+static int parser_next_line(chttp_parser *p, const char *buf, size_t len, size_t *start, size_t *end)
+{
+    // Finding the line end and rejecting stray control characters in the same
+    // pass.
+    size_t e = p->scan + chttp_scan(buf + p->scan, len - p->scan, '\n', '\n');
+    if (e == len)
+    {
+        p->scan = len;
+        return 0;
+    }
+
+    *start = p->line;
+    *end = e;
+    if (buf[e] == '\r')
+    {
+        if (e + 1 == len)
+        {
+            p->scan = e;
+            return 0;
+        }
+        if (buf[e + 1] != '\n')
+            return -1;
+        p->line = p->scan = e + 2;
+    } else if (buf[e] == '\n')
+        p->line = p->scan = e + 1;
+    else
+        return -1;
+    return 1;
+}
+
+// Consuming complete lines of the request head. Returns 1 once the blank line
+// after the headers has been seen, 0 if more data is needed and -1 on error.
+static int parser_lines(chttp_parser *p, const char *buf, size_t len)
+{
+    size_t start, end;
+    int r;
+    while ((r = parser_next_line(p, buf, len, &start, &end)) > 0)
+    {
+        if (p->state == PARSER_REQUEST_LINE)
+        {
+            // Ignoring empty lines ahead of the request line, as RFC 7230
+            // suggests.
+            if (end == start)
+                continue;
+            if (parse_request_line(&p->view, buf, start, end))
+                return -1;
+            p->state = PARSER_HEADERS;
         } else
         {
-            mode = 0;
-            buf[i] = (char)c;
+            if (end == start)
+                return 1;
+            if (buf[start] == ' ' || buf[start] == '\t')
+                return -1;
+            if (parse_header_line(&p->view, buf, start, end))
+                return -1;
         }
     }
-
-    if (bk != NULL && (c <= 0 || feof(f)))
-        *bk = 1;
-    buf[i] = '\0';
-    return i;
+    return r;
 }
 
-// Filling a token (as defined by whitespace) for parsing.
-static size_t fill_token(FILE *f, char *buf, size_t len)
+// Passing on up to p->body_left bytes of body from p->scan, either to the body
+// callback or down to the end of the body decoded so far.
+static int parser_body(chttp_parser *p, char *buf, size_t len)
 {
-    return fill_tokenb(f, buf, len, NULL);
-    int c;
-    while (isspace(c = fgetc(f)) && !feof(f)) { }
-    ungetc(c, f);
+    size_t take = len - p->scan < p->body_left ? len - p->scan : p->body_left;
+    if (take == 0)
+        return 0;
+
+    if (p->on_body != NULL)
+    {
+        if (p->on_body(p->on_body_arg, buf + p->scan, take))
+            return -1;
+    } else
+    {
+        size_t end = p->view.body.off + p->view.body.len;
+        if (end != p->scan)
+            memmove(buf + end, buf + p->scan, take);
+        p->view.body.len += take;
+    }
+
+    p->line = p->scan = p->scan + take;
+    p->body_left -= take;
+    return 0;
+}
 
-    size_t i;
-    for (i = 0; i < len; i++)
+// Decoding as much of a chunked body as has arrived. Returns 1 once the last
+// chunk and any trailers are consumed, 0 if more data is needed and -1 on
+// error.
+static int parser_chunks(chttp_parser *p, char *buf, size_t len)
+{
+    size_t start, end;
+    int r;
+    while (1)
     {
-        c = fgetc(f);
-        if (c < 0 || c == '\0' || isspace(c))
+        switch (p->state)
         {
-            buf[i] = '\0';
-            if (isspace(c))
-                ungetc(c, f);
+        case PARSER_CHUNK_SIZE:
+            if ((r = parser_next_line(p, buf, len, &start, &end)) <= 0)
+                return r;
+            if (parse_chunk_size(buf + start, end - start, &p->body_left))
+                return -1;
+            p->state = p->body_left > 0 ? PARSER_CHUNK_DATA : PARSER_TRAILERS;
+            break;
+
+        case PARSER_CHUNK_DATA:
+            if (parser_body(p, buf, len))
+                return -1;
+            if (p->body_left > 0)
+                return 0;
+            p->state = PARSER_CHUNK_END;
+            break;
+
+        case PARSER_CHUNK_END:
+            if ((r = parser_next_line(p, buf, len, &start, &end)) <= 0)
+                return r;
+            if (end != start)
+                return -1;
+            p->state = PARSER_CHUNK_SIZE;
+            break;
+
+        default:
+            // Trailer fields are read past but not kept.
+            if ((r = parser_next_line(p, buf, len, &start, &end)) <= 0)
+                return r;
+            if (end == start)
+                return 1;
             break;
         }
+    }
+}
+
+// Resetting a parser.
+void chttp_parser_init(chttp_parser *p)
+{
+    p->state = PARSER_REQUEST_LINE;
+    p->line = 0;
+    p->scan = 0;
+    p->head_length = 0;
+    p->content_length = 0;
+    p->chunked = 0;
+    p->body_left = 0;
+    p->on_body = NULL;
+    p->on_body_arg = NULL;
+    p->view.header_count = 0;
+    p->view.body.off = 0;
+    p->view.body.len = 0;
+}
+
+// Streaming a parser's body to a callback.
+void chttp_parser_on_body(chttp_parser *p, chttp_body_callback on_body, void *arg)
+{
+    p->on_body = on_body;
+    p->on_body_arg = arg;
+}
+
+// Advancing a parser over newly received data.
+chttp_parser_status chttp_parser_execute(chttp_parser *p, char *buf, size_t len)
+{
+    if (p->state == PARSER_REQUEST_LINE || p->state == PARSER_HEADERS)
+    {
+        int r = parser_lines(p, buf, len);
+        if (r < 0)
+            return CHTTP_PARSER_ERROR;
+        if (r == 0)
+            return CHTTP_PARSER_NEED_MORE;
+
+        if (parser_frame_body(p, buf))
+            return CHTTP_PARSER_ERROR;
+        p->head_length = p->line;
+        p->view.body.off = p->head_length;
+        p->body_left = p->content_length;
+        p->state = p->chunked ? PARSER_CHUNK_SIZE : PARSER_BODY;
+    }
+
+    if (p->state == PARSER_BODY)
+    {
+        if (parser_body(p, buf, len))
+            return CHTTP_PARSER_ERROR;
+        if (p->body_left > 0)
+            return CHTTP_PARSER_HEADERS_COMPLETE;
+        p->state = PARSER_DONE;
+    } else if (p->state != PARSER_DONE)
+    {
+        int r = parser_chunks(p, buf, len);
+        if (r < 0)
+            return CHTTP_PARSER_ERROR;
+        if (r == 0)
+            return CHTTP_PARSER_HEADERS_COMPLETE;
+        p->state = PARSER_DONE;
+    }
+
+    return CHTTP_PARSER_MESSAGE_COMPLETE;
+}
+
+// Dropping body bytes a body callback has already been given.
+size_t chttp_parser_trim(chttp_parser *p, char *buf, size_t len)
+{
+    if (p->on_body == NULL || p->state < PARSER_BODY || p->line == p->head_length)
+        return len;
+
+    size_t drop = p->line - p->head_length;
+    memmove(buf + p->head_length, buf + p->line, len - p->line);
+    p->line -= drop;
+    p->scan -= drop;
+    return len - drop;
+}
+
+// Getting the full length of a parsed request.
+size_t chttp_parser_message_length(const chttp_parser *p)
+{
+    return p->line;
+}
+
+// Parsing a chttp_request_view straight out of a buffer.
+long chttp_parse_request_view(chttp_request_view *v, const char *buf, size_t len)
+{
+    chttp_parser p;
+    chttp_parser_init(&p);
+    memset(&p.view, 0, sizeof(chttp_request_view));
+
+    int r = parser_lines(&p, buf, len);
+    *v = p.view;
+    if (r < 0)
+        return CHTTP_PARSE_ERROR;
+    if (r == 0)
+        return CHTTP_PARSE_INCOMPLETE;
+
+    v->body.off = p.line;
+    v->body.len = len - p.line;
+    return p.line;
+}
+
+// Finding a header in a view by name, ignoring case.
+int chttp_view_find_header(const chttp_request_view *v, const char *buf, const char *header)
+{
+    size_t len = strlen(header);
+    for (int i = 0; i < v->header_count; i++)
+        if (v->headers[i].name.len == len && strncasecmp(buf + v->headers[i].name.off, header, len) == 0)
+            return i;
+    return -1;
+}
+
+// Finding a well-known header in a view by its id.
+int chttp_view_find_known(const chttp_request_view *v, chttp_header_id id)
+{
+    for (int i = 0; i < v->header_count; i++)
+        if (v->headers[i].id == id)
+            return i;
+    return -1;
+}
+
+// Setting the method of a request from a parsed request line. Standard
+// methods need no lookup, since the parser has already recognized them, and
+// a method that is not registered is copied into the request rather than
+// interned, so clients cannot fill the table.
+static void request_method(chttp_request *r, const chttp_request_view *v, const char *buf)
+{
+    const char *token = buf + v->method_name.off;
+    size_t len = v->method_name.len;
 
-        buf[i] = c;
+    r->method = v->method;
+    if (v->method != OTHER)
+        r->method_name = chttp_method_name(v->method);
+    else if ((r->method_name = chttp_method_intern(token, len)) == NULL && len < CHTTP_METHOD_NAME_LENGTH)
+    {
+        memcpy(r->method_token, token, len);
+        r->method_token[len] = '\0';
+        r->method_name = r->method_token;
     }
+}
 
-    return i;
+// Copying a span into a fixed-size, NUL-terminated field.
+static int copy_span(char *dst, size_t dst_len, const char *buf, chttp_span s)
+{
+    if (s.len >= dst_len)
+        return -1;
+    memcpy(dst, buf + s.off, s.len);
+    dst[s.len] = '\0';
+    return 0;
 }
 
-#define chttp_pmp(buf, method_var, method) \
-    do { if (strcmp(buf, #method) == 0) method_var = method; } while (0);
+// Deriving a chttp_request from a chttp_request_view.
+int chttp_request_from_view(chttp_request *r, const chttp_request_view *v, const char *buf)
+{
+    request_method(r, v, buf);
+    if (copy_span(r->uri, CHTTP_URI_LENGTH, buf, v->uri))
+        return -1;
+    if (copy_span(r->http_version, CHTTP_HTTP_VERSION_LENGTH, buf, v->http_version))
+        return -1;
+
+    for (int i = 0; i < v->header_count; i++)
+    {
+        const chttp_span_header *h = &v->headers[i];
+        if (chttp_add_header_n(r->headers, buf + h->name.off, h->name.len, buf + h->value.off, h->value.len))
+            return -1;
+    }
+
+    r->body = (char *)buf + v->body.off;
+    r->body_len = v->body.len;
+    return 0;
+}
 
-// Parsing out a chttp_method from a FILE.
-static size_t parse_method(FILE *f, chttp_method *method)
+// Reading one line of a message head into buf, line ending included. Returns
+// its length without the line ending, or -1 at the end of the stream or if the
+// line does not fit. raw_len is set to the length with the line ending.
+static long read_line(FILE *f, char *buf, size_t len, size_t *raw_len)
 {
-    const int l = CHTTP_METHOD_LENGTH + 1;
-    char buf[CHTTP_METHOD_LENGTH];
-    size_t len = fill_token(f, buf, l);
+    if (fgets(buf, len, f) == NULL)
+        return -1;
 
-    *method = OTHER;
-    chttp_pmp(buf, *method, OPTIONS);
-    chttp_pmp(buf, *method, GET);
-    chttp_pmp(buf, *method, HEAD);
-    chttp_pmp(buf, *method, POST);
-    chttp_pmp(buf, *method, PUT);
-    chttp_pmp(buf, *method, DELETE);
-    chttp_pmp(buf, *method, TRACE);
-    chttp_pmp(buf, *method, CONNECT);
+    size_t n = strlen(buf);
+    if (n == 0 || (buf[n - 1] != '\n' && !feof(f)))
+        return -1;
+    *raw_len = n;
 
-    return len;
+    while (n > 0 && (buf[n - 1] == '\n' || buf[n - 1] == '\r'))
+        n--;
+    return n;
 }
 
-// Parsing a chttp_request from a given string. Returns the number of characters
-// read on success. Returns -1 on failure. Inverse of chttp_sprint_request.
-size_t chttp_parse_request(chttp_request *r, FILE *f)
+// A body being read by the FILE-based parsers, grown as it arrives. Storage
+// comes from the message's arena when it has one.
+typedef struct
 {
-    size_t start = ftell(f);
-    parse_method(f, &r->method);
+    chttp_arena *arena;
+    char *data;
+    size_t len;
+    size_t size;
+} body_buffer;
+
+// Making room for more bytes plus a NUL at the end of a body buffer.
+static int body_reserve(body_buffer *b, size_t more)
+{
+    if (more > (size_t)-1 / 2 - b->len)
+        return -1;
+    size_t need = b->len + more + 1;
+    if (need <= b->size)
+        return 0;
 
-    fill_token(f, r->uri, CHTTP_URI_LENGTH);
-    fill_token(f, r->http_version, CHTTP_HTTP_VERSION_LENGTH);
+    size_t size = b->size * 2 > need ? b->size * 2 : need;
+    char *data = b->arena ? (char *)chttp_arena_alloc(b->arena, size) : (char *)realloc(b->data, size);
+    if (data == NULL)
+        return -1;
+    if (b->arena != NULL && b->len > 0)
+        memcpy(data, b->data, b->len);
+    b->data = data;
+    b->size = size;
+    return 0;
+}
 
-    char header[CHTTP_HEADER_KEY_LENGTH];
-    char value[CHTTP_HEADER_VALUE_LENGTH];
-    size_t e = 0;
-    while (!feof(f))
+// Reading exactly len body bytes. Large lengths are read a block at a time so
+// a bogus Content-Length cannot make us allocate more than actually arrives.
+static int body_read(body_buffer *b, FILE *f, size_t len)
+{
+    while (len > 0)
     {
-        e = fill_token(f, header, CHTTP_HEADER_KEY_LENGTH);
-        if (header[e - 1] != ':')
+        size_t step = len < CHTTP_ARENA_BLOCK_SIZE ? len : CHTTP_ARENA_BLOCK_SIZE;
+        if (body_reserve(b, step) || fread(b->data + b->len, sizeof(char), step, f) != step)
+            return -1;
+        b->len += step;
+        len -= step;
+    }
+    return 0;
+}
+
+// Reading a chunked body.
+static int read_chunked(FILE *f, body_buffer *b)
+{
+    char line[CHTTP_HEADER_VALUE_LENGTH];
+    size_t raw;
+    while (1)
+    {
+        long line_len = read_line(f, line, sizeof(line), &raw);
+        size_t size;
+        if (line_len < 0 || parse_chunk_size(line, line_len, &size))
+            return -1;
+        if (size == 0)
+            break;
+
+        if (body_read(b, f, size) || read_line(f, line, sizeof(line), &raw) != 0)
+            return -1;
+    }
+
+    // Skipping trailer fields up to the blank line.
+    while (read_line(f, line, sizeof(line), &raw) > 0) { }
+    return 0;
+}
+
+// Reading header lines and then the body as framed by Transfer-Encoding or
+// Content-Length. For compatibility with hand-written messages, a line that is
+// not a header also ends the headers and starts a body that runs to the end of
+// the stream.
+static int parse_fields(FILE *f, chttp_header_set *headers, body_buffer *b)
+{
+    char line[CHTTP_HEADER_KEY_LENGTH + CHTTP_HEADER_VALUE_LENGTH + 4];
+    size_t raw = 0;
+    long len;
+    while ((len = read_line(f, line, sizeof(line), &raw)) > 0)
+    {
+        char *colon = memchr(line, ':', len);
+        if (colon == NULL || colon == line || memchr(line, ' ', colon - line) != NULL ||
+            memchr(line, '\t', colon - line) != NULL)
+        {
+            if (body_reserve(b, raw))
+                return -1;
+            memcpy(b->data, line, raw);
+            b->len = raw;
             break;
-        header[e - 1] = '\0';
-        fill_token(f, value, CHTTP_HEADER_VALUE_LENGTH);
+        }
+
+        char *value = colon + 1;
+        char *end = line + len;
+        while (*value == ' ' || *value == '\t')
+            value++;
+        while (end > value && (end[-1] == ' ' || end[-1] == '\t'))
+            end--;
+        if (chttp_add_header_n(headers, line, colon - line, value, end - value))
+            return -1;
+    }
 
-        chttp_add_header(r->headers, header, value);
+    int r = 0;
+    const char *te = chttp_get_header(headers, "Transfer-Encoding");
+    const char *cl = chttp_get_header(headers, "Content-Length");
+    size_t n;
+    if (len == 0 && te != NULL)
+    {
+        if (strcasecmp(te, "chunked") != 0 || cl != NULL)
+            return -1;
+        r = read_chunked(f, b);
+    } else if (len == 0 && cl != NULL)
+    {
+        if (parse_content_length(cl, strlen(cl), &n))
+            return -1;
+        r = body_read(b, f, n);
+    } else
+    {
+        do
+        {
+            if (body_reserve(b, 4096))
+                return -1;
+            n = fread(b->data + b->len, sizeof(char), 4096, f);
+            b->len += n;
+        } while (n == 4096);
     }
 
-    memcpy(r->body, header, e);
-    size_t n = fread(r->body + e, sizeof(char), CHTTP_BODY_LENGTH - 1, f);
-    (r->body + e)[n] = '\0';
+    if (r == 0 && body_reserve(b, 0) == 0)
+        b->data[b->len] = '\0';
+    return r;
+}
+
+// Starting a body buffer for a message, dropping any body it already owns.
+static void body_start(body_buffer *b, chttp_header_set *headers, char **storage)
+{
+    b->arena = headers->arena;
+    b->data = NULL;
+    b->len = 0;
+    b->size = 0;
+    if (b->arena == NULL)
+        free(*storage);
+    *storage = NULL;
+}
 
+// Handing a body buffer's contents to its message.
+static void body_finish(body_buffer *b, char **body, size_t *body_len, char **storage)
+{
+    *body = b->data;
+    *body_len = b->len;
+    if (b->arena == NULL)
+        *storage = b->data;
+}
+
+// Parsing a chttp_request from a given string. Returns the number of characters
+// read on success. Returns -1 on failure. Inverse of chttp_sprint_request.
+size_t chttp_parse_request(chttp_request *r, FILE *f)
+{
+    size_t start = ftell(f);
+
+    // Skipping blank lines ahead of the request line.
+    char line[CHTTP_METHOD_LENGTH + CHTTP_URI_LENGTH + CHTTP_HTTP_VERSION_LENGTH + 4];
+    size_t raw;
+    long len;
+    while ((len = read_line(f, line, sizeof(line), &raw)) == 0) { }
+    if (len < 0)
+        return -1;
+
+    chttp_request_view v;
+    v.header_count = 0;
+    if (parse_request_line(&v, line, 0, len))
+        return -1;
+
+    request_method(r, &v, line);
+    if (copy_span(r->uri, CHTTP_URI_LENGTH, line, v.uri))
+        return -1;
+    if (copy_span(r->http_version, CHTTP_HTTP_VERSION_LENGTH, line, v.http_version))
+        return -1;
+
+    body_buffer b;
+    body_start(&b, r->headers, &r->body_storage);
+    int failed = parse_fields(f, r->headers, &b);
+    body_finish(&b, &r->body, &r->body_len, &r->body_storage);
+    if (failed)
+        return -1;
     return ftell(f) - start;
 }
 
@@ -135,28 +686,33 @@ size_t chttp_parse_request(chttp_request *r, FILE *f)
 size_t chttp_parse_response(chttp_response *r, FILE *f)
 {
     size_t start = ftell(f);
-    fill_token(f, r->http_version, CHTTP_HTTP_VERSION_LENGTH);
-    fscanf(f, "%d", &r->code);
-    fill_token(f, r->reason_phrase, CHTTP_REASON_PHRASE_LENGTH);
 
-    char header[CHTTP_HEADER_KEY_LENGTH];
-    char value[CHTTP_HEADER_VALUE_LENGTH];
-    size_t e = 0;
-    while (!feof(f))
-    {
-        e = fill_token(f, header, CHTTP_HEADER_KEY_LENGTH);
-        if (header[e - 1] != ':')
-            break;
-        header[e - 1] = '\0';
-        fill_token(f, value, CHTTP_HEADER_VALUE_LENGTH);
+    char line[CHTTP_HTTP_VERSION_LENGTH + CHTTP_REASON_PHRASE_LENGTH + 16];
+    size_t raw;
+    long len = read_line(f, line, sizeof(line), &raw);
+    if (len < 0)
+        return -1;
 
-        chttp_add_header(r->headers, header, value);
-    }
+    // "<version> <code> <reason>", where the reason may contain spaces.
+    char *code = memchr(line, ' ', len);
+    if (code == NULL || copy_span(r->http_version, CHTTP_HTTP_VERSION_LENGTH, line,
+                                  (chttp_span){ 0, code - line }))
+        return -1;
 
-    memcpy(r->body, header, e);
-    size_t n = fread(r->body + e, sizeof(char), CHTTP_BODY_LENGTH - 1, f);
-    (r->body + e)[n] = '\0';
+    char *reason;
+    r->code = strtol(code + 1, &reason, 10);
+    while (*reason == ' ')
+        reason++;
+    chttp_span s = { reason - line, line + len - reason };
+    if (copy_span(r->reason_phrase, CHTTP_REASON_PHRASE_LENGTH, line, s))
+        return -1;
 
+    body_buffer b;
+    body_start(&b, r->headers, &r->body_storage);
+    int failed = parse_fields(f, r->headers, &b);
+    body_finish(&b, &r->body, &r->body_len, &r->body_storage);
+    if (failed)
+        return -1;
     return ftell(f) - start;
 }
 
@@ -1,26 +1,21 @@
 #include "chttp.h"
 
 #include <stdarg.h>
+#include <stdint.h>
 #include <string.h>
+#include <errno.h>
+#include <unistd.h>
 
 // Printing a method to a string.
 size_t chttp_sprint_method(chttp_method method, char *str, int len)
 {
-    char *method_str;
-    switch (method)
-    {
-    case OPTIONS: method_str = "OPTIONS"; break;
-    case GET:     method_str = "GET";     break;
-    case HEAD:    method_str = "HEAD";    break;
-    case POST:    method_str = "POST";    break;
-    case PUT:     method_str = "PUT";     break;
-    case DELETE:  method_str = "DELETE";  break;
-    case TRACE:   method_str = "TRACE";   break;
-    case CONNECT: method_str = "CONNECT"; break;
-    case OTHER:   method_str = "OTHER";   break;
-    }
+    return (size_t)(stpcpy(str, chttp_method_name(method)) - str);
+}
 
-    return (size_t)(stpcpy(str, method_str) - str);
+// Getting the token to print for a request's method.
+static const char *request_method(chttp_request *r)
+{
+    return r->method_name != NULL ? r->method_name : chttp_method_name(r->method);
 }
 
 // Utility for printing iteratively into a string.
@@ -36,6 +31,61 @@ static int chttp_sprint(char *dst, int len, const char *format, size_t *n, ...)
     return 0;
 }
 
+// Something a body is written to.
+typedef int (*body_sink)(void *arg, const char *data, size_t len);
+
+// Writing a body to a sink: body_len bytes of body, or else whatever the
+// producer yields.
+static int body_write(const char *body, size_t body_len, chttp_body_producer producer, void *producer_arg,
+                      body_sink sink, void *sink_arg)
+{
+    if (body_len > 0 || producer == NULL)
+        return body_len > 0 ? sink(sink_arg, body, body_len) : 0;
+
+    char buf[4096];
+    long n;
+    while ((n = producer(producer_arg, buf, sizeof(buf))) > 0)
+        if (sink(sink_arg, buf, n))
+            return -1;
+    return n < 0 ? -1 : 0;
+}
+
+// A string being printed into by chttp_sprint.
+typedef struct
+{
+    char *dst;
+    int len;
+    size_t *n;
+} string_sink;
+
+// Appending body bytes to a string.
+static int string_write(void *arg, const char *data, size_t len)
+{
+    string_sink *s = (string_sink *)arg;
+    if (len > (size_t)s->len - *s->n)
+        return -1;
+    memcpy(s->dst + *s->n, data, len);
+    *s->n += len;
+    return 0;
+}
+
+// A file being printed into by chttp_fprint_*.
+typedef struct
+{
+    FILE *f;
+    size_t *n;
+} file_sink;
+
+// Appending body bytes to a file, counting them.
+static int file_write(void *arg, const char *data, size_t len)
+{
+    file_sink *s = (file_sink *)arg;
+    if (fwrite(data, sizeof(char), len, s->f) != len)
+        return -1;
+    *s->n += len;
+    return 0;
+}
+
 // Printing a chttp_request to a given string. Returns the number of characters
 // printed if there is enough room. If not, it returns -1. Inverse of
 // chttp_parse_request.
@@ -43,17 +93,17 @@ size_t chttp_sprint_request(chttp_request *r, char *string, int len)
 {
     size_t n = 0;
 
-    char method[CHTTP_METHOD_LENGTH];
-    chttp_sprint_method(r->method, method, CHTTP_METHOD_LENGTH);
-
-    if (chttp_sprint(string, len, "%s %s %s\r\n", &n, method, r->uri, r->http_version))
+    if (chttp_sprint(string, len, "%s %s %s\r\n", &n, request_method(r), r->uri, r->http_version))
         return -1;
     for (int i = 0; i < r->headers->len; i++)
-        if (chttp_sprint(string, len, "%s: %s\r\n", &n, r->headers->headers[i].header, r->headers->headers[i].value))
+        if (chttp_sprint(string, len, "%s: %s\r\n", &n, chttp_header_key(r->headers, i), chttp_header_value(r->headers, i)))
             return -1;
     if (chttp_sprint(string, len, "\r\n", &n))
         return -1;
-    if (chttp_sprint(string, len, "%s\r\n\r\n", &n, r->body))
+    string_sink sink = { string, len, &n };
+    if (body_write(r->body, r->body_len, r->body_producer, r->body_producer_arg, &string_write, &sink))
+        return -1;
+    if (chttp_sprint(string, len, "\r\n\r\n", &n))
         return -1;
 
     if (n == len)
@@ -62,6 +112,67 @@ size_t chttp_sprint_request(chttp_request *r, char *string, int len)
     return n + 1;
 }
 
+// Formatting a status line into buf, filling in an implied version or reason.
+static size_t format_status_line(chttp_response *r, char *buf)
+{
+    char *p = stpcpy(buf, r->http_version[0] ? r->http_version : "HTTP/1.1");
+    *p++ = ' ';
+
+    char digits[16];
+    int n = 0;
+    unsigned int code = r->code;
+    do
+    {
+        digits[n++] = '0' + code % 10;
+        code /= 10;
+    } while (code > 0);
+    while (n > 0)
+        *p++ = digits[--n];
+
+    const char *reason = r->reason_phrase;
+    if (reason[0] == '\0' && (reason = chttp_status_reason(r->code)) == NULL)
+        reason = "";
+    *p++ = ' ';
+    p = stpcpy(p, reason);
+    p = stpcpy(p, "\r\n");
+    return (size_t)(p - buf);
+}
+
+// Getting the status line of a response. A registered code whose version and
+// reason are implied or match the registered ones comes straight from the
+// table; anything else is formatted into buf.
+static size_t status_line(chttp_response *r, char *buf, const char **line)
+{
+    size_t len;
+    const char *fixed = chttp_status_line(r->code, &len);
+    if (fixed != NULL && (r->http_version[0] == '\0' || strcmp(r->http_version, "HTTP/1.1") == 0) &&
+        (r->reason_phrase[0] == '\0' || strcmp(r->reason_phrase, chttp_status_reason(r->code)) == 0))
+    {
+        *line = fixed;
+        return len;
+    }
+
+    *line = buf;
+    return format_status_line(r, buf);
+}
+
+// Printing the status line, headers and blank line of a response.
+static int sprint_response_head(chttp_response *r, char *string, int len, size_t *n)
+{
+    char buf[CHTTP_STATUS_LINE_LENGTH];
+    const char *line;
+    size_t line_len = status_line(r, buf, &line);
+    string_sink sink = { string, len, n };
+    if (string_write(&sink, line, line_len))
+        return 1;
+    for (int i = 0; i < r->headers->len; i++)
+        if (chttp_sprint(string, len, "%s: %s\r\n", n, chttp_header_key(r->headers, i), chttp_header_value(r->headers, i)))
+            return 1;
+    if (chttp_sprint(string, len, "\r\n", n))
+        return 1;
+    return 0;
+}
+
 // Printing a chttp_response to a given string. Returns the number of characters
 // printed if there is enough room. If not, it returns -1. Inverse of
 // chttp_arse_response.
@@ -69,14 +180,12 @@ size_t chttp_sprint_response(chttp_response *r, char *string, int len)
 {
     size_t n = 0;
 
-    if (chttp_sprint(string, len, "%s %d %s\r\n", &n, r->http_version, r->code, r->reason_phrase))
+    if (sprint_response_head(r, string, len, &n))
         return -1;
-    for (int i = 0; i < r->headers->len; i++)
-        if (chttp_sprint(string, len, "%s: %s\r\n", &n, r->headers->headers[i].header, r->headers->headers[i].value))
-            return -1;
-    if (chttp_sprint(string, len, "\r\n", &n))
+    string_sink sink = { string, len, &n };
+    if (body_write(r->body, r->body_len, r->body_producer, r->body_producer_arg, &string_write, &sink))
         return -1;
-    if (chttp_sprint(string, len, "%s\r\n\r\n", &n, r->body))
+    if (chttp_sprint(string, len, "\r\n\r\n", &n))
         return -1;
 
     if (n == len)
@@ -85,19 +194,186 @@ size_t chttp_sprint_response(chttp_response *r, char *string, int len)
     return n + 1;
 }
 
+// Printing only the head of a chttp_response to a given string.
+size_t chttp_sprint_response_head(chttp_response *r, char *string, int len)
+{
+    size_t n = 0;
+
+    if (sprint_response_head(r, string, len, &n))
+        return -1;
+
+    if (n == len)
+        return -1;
+    string[n] = '\0';
+    return n;
+}
+
+// Printing the status line of a response.
+size_t chttp_sprint_status_line(chttp_response *r, char *string)
+{
+    const char *line;
+    size_t len = status_line(r, string, &line);
+    if (line != string)
+        memcpy(string, line, len + 1);
+    return len;
+}
+
+// Counting the iovecs needed to serialize a response.
+int chttp_response_iovcnt(chttp_response *r)
+{
+    return 4 * r->headers->len + 3;
+}
+
+// Pointing an iovec at len bytes of str.
+static inline void iov_set(struct iovec *iov, const char *str, size_t len)
+{
+    iov->iov_base = (void *)str;
+    iov->iov_len = len;
+}
+
+// Pointing four iovecs per header at a header set's names and values.
+static int iov_headers(chttp_header_set *set, struct iovec *iov)
+{
+    int n = 0;
+    for (int i = 0; i < set->len; i++)
+    {
+        chttp_header *h = &set->headers[i];
+        iov_set(&iov[n++], set->data + h->header, h->header_len);
+        iov_set(&iov[n++], ": ", 2);
+        iov_set(&iov[n++], set->data + h->value, h->value_len);
+        iov_set(&iov[n++], "\r\n", 2);
+    }
+    return n;
+}
+
+// Describing a chttp_response as a list of buffers.
+int chttp_iov_response(chttp_response *r, const char *body, size_t body_len, char *status,
+                       struct iovec *iov, int iovcnt)
+{
+    if (iovcnt < chttp_response_iovcnt(r))
+        return -1;
+
+    int n = 0;
+    const char *line;
+    size_t line_len = status_line(r, status, &line);
+    iov_set(&iov[n++], line, line_len);
+
+    n += iov_headers(r->headers, iov + n);
+    iov_set(&iov[n++], "\r\n", 2);
+
+    if (body != NULL && body_len > 0)
+        iov_set(&iov[n++], body, body_len);
+    return n;
+}
+
+// Writing buffers to a file descriptor until they are all written.
+int chttp_fd_sink(void *arg, const struct iovec *iov, int iovcnt)
+{
+    int fd = (int)(intptr_t)arg;
+    struct iovec rest[iovcnt];
+    memcpy(rest, iov, sizeof(struct iovec) * iovcnt);
+
+    struct iovec *v = rest;
+    while (iovcnt > 0)
+    {
+        ssize_t n = writev(fd, v, iovcnt);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+
+        // Skipping past what was written, possibly ending inside a buffer.
+        while (iovcnt > 0 && (size_t)n >= v->iov_len)
+        {
+            n -= v->iov_len;
+            v++;
+            iovcnt--;
+        }
+        if (iovcnt > 0)
+        {
+            v->iov_base = (char *)v->iov_base + n;
+            v->iov_len -= n;
+        }
+    }
+    return 0;
+}
+
+// Starting a chunked response.
+int chttp_chunked_begin(chttp_chunked_writer *w, chttp_response *r, chttp_sink sink, void *arg)
+{
+    w->sink = sink;
+    w->arg = arg;
+    w->done = 0;
+
+    if (chttp_get_header(r->headers, "Transfer-Encoding") == NULL &&
+        chttp_add_header(r->headers, "Transfer-Encoding", "chunked"))
+        return -1;
+
+    char status[CHTTP_STATUS_LINE_LENGTH];
+    int iovcnt = chttp_response_iovcnt(r);
+    struct iovec iov[iovcnt];
+    iovcnt = chttp_iov_response(r, NULL, 0, status, iov, iovcnt);
+    return sink(arg, iov, iovcnt);
+}
+
+// Sending one chunk of a chunked response.
+int chttp_chunked_write(chttp_chunked_writer *w, const char *data, size_t len)
+{
+    if (w->done)
+        return -1;
+    if (len == 0)
+        return 0;
+
+    // The chunk size in hexadecimal, written backwards from the end.
+    char size[2 * sizeof(size_t) + 2];
+    char *p = size + sizeof(size);
+    *--p = '\n';
+    *--p = '\r';
+    size_t n = len;
+    do
+    {
+        *--p = "0123456789abcdef"[n & 0xf];
+        n >>= 4;
+    } while (n > 0);
+
+    struct iovec iov[3];
+    iov_set(&iov[0], p, size + sizeof(size) - p);
+    iov_set(&iov[1], data, len);
+    iov_set(&iov[2], "\r\n", 2);
+    return w->sink(w->arg, iov, 3);
+}
+
+// Ending a chunked response.
+int chttp_chunked_end(chttp_chunked_writer *w, chttp_header_set *trailers)
+{
+    if (w->done)
+        return -1;
+    w->done = 1;
+
+    int len = trailers != NULL ? trailers->len : 0;
+    struct iovec iov[4 * len + 2];
+    int n = 0;
+    iov_set(&iov[n++], "0\r\n", 3);
+    if (trailers != NULL)
+        n += iov_headers(trailers, iov + n);
+    iov_set(&iov[n++], "\r\n", 2);
+    return w->sink(w->arg, iov, n);
+}
+
 // Printing a chttp_request to FILE *f.
 size_t chttp_fprint_request(FILE *f, chttp_request *r)
 {
     size_t n = 0;
 
-    char method[CHTTP_METHOD_LENGTH];
-    n += chttp_sprint_method(r->method, method, CHTTP_METHOD_LENGTH);
-
-    n += fprintf(f, "%s %s %s\r\n", method, r->uri, r->http_version);
+    n += fprintf(f, "%s %s %s\r\n", request_method(r), r->uri, r->http_version);
     for (int i = 0; i < r->headers->len; i++)
-        n += fprintf(f, "%s: %s\r\n", r->headers->headers[i].header, r->headers->headers[i].value);
+        n += fprintf(f, "%s: %s\r\n", chttp_header_key(r->headers, i), chttp_header_value(r->headers, i));
     n += fprintf(f, "\r\n");
-    n += fprintf(f, "%s\r\n\r\n", r->body);
+    file_sink sink = { f, &n };
+    body_write(r->body, r->body_len, r->body_producer, r->body_producer_arg, &file_write, &sink);
+    n += fprintf(f, "\r\n\r\n");
 
     return n;
 }
@@ -107,11 +383,16 @@ size_t chttp_fprint_response(FILE *f, chttp_response *r)
 {
     size_t n = 0;
 
-    n += fprintf(f, "%s %d %s\r\n", r->http_version, r->code, r->reason_phrase);
+    char buf[CHTTP_STATUS_LINE_LENGTH];
+    const char *line;
+    size_t line_len = status_line(r, buf, &line);
+    n += fwrite(line, sizeof(char), line_len, f);
     for (int i = 0; i < r->headers->len; i++)
-        n += fprintf(f, "%s: %s\r\n", r->headers->headers[i].header, r->headers->headers[i].value);
+        n += fprintf(f, "%s: %s\r\n", chttp_header_key(r->headers, i), chttp_header_value(r->headers, i));
     n += fprintf(f, "\r\n");
-    n += fprintf(f, "%s\r\n\r\n", r->body);
+    file_sink sink = { f, &n };
+    body_write(r->body, r->body_len, r->body_producer, r->body_producer_arg, &file_write, &sink);
+    n += fprintf(f, "\r\n\r\n");
 
     return n;
 }
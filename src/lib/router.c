@@ -0,0 +1,398 @@
+#include "chttp.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// A handler registered on a node, for one method or CHTTP_ROUTE_ANY.
+typedef struct route_target route_target;
+struct route_target
+{
+    route_target *next;
+    int method;
+    chttp_route_handler handler;
+    void *data;
+};
+
+// A node of the tree. label is the run of pattern characters on the edge
+// into the node, pointing into a registered pattern. Static children are
+// told apart by their first character, kept in first for a quick scan. A
+// parameter child matches one segment instead and has no label.
+struct chttp_route_node
+{
+    const char *label;
+    size_t label_len;
+
+    chttp_route_node **children;
+    char *first;
+    int child_count;
+
+    chttp_route_node *param;
+    const char *param_name;
+    size_t param_name_len;
+
+    route_target *routes;
+    route_target *mounts;
+};
+
+// Allocating an empty node.
+static chttp_route_node *node_allocate(const char *label, size_t label_len)
+{
+    chttp_route_node *n = (chttp_route_node *)calloc(1, sizeof(chttp_route_node));
+    if (n != NULL)
+    {
+        n->label = label;
+        n->label_len = label_len;
+    }
+    return n;
+}
+
+// Finding the static child whose label starts with c.
+static int node_child(const chttp_route_node *n, char c)
+{
+    const char *f = n->child_count ? (const char *)memchr(n->first, c, n->child_count) : NULL;
+    return f ? (int)(f - n->first) : -1;
+}
+
+// Adding a static child.
+static int node_add_child(chttp_route_node *n, chttp_route_node *child)
+{
+    chttp_route_node **children =
+        (chttp_route_node **)realloc(n->children, sizeof(chttp_route_node *) * (n->child_count + 1));
+    if (children == NULL)
+        return -1;
+    n->children = children;
+
+    char *first = (char *)realloc(n->first, n->child_count + 1);
+    if (first == NULL)
+        return -1;
+    n->first = first;
+
+    n->children[n->child_count] = child;
+    n->first[n->child_count] = child->label[0];
+    n->child_count++;
+    return 0;
+}
+
+// Freeing a node and everything below it.
+static void node_free(chttp_route_node *n)
+{
+    if (n == NULL)
+        return;
+
+    for (int i = 0; i < n->child_count; i++)
+        node_free(n->children[i]);
+    node_free(n->param);
+
+    route_target *lists[] = { n->routes, n->mounts };
+    for (int i = 0; i < 2; i++)
+    {
+        for (route_target *t = lists[i]; t != NULL;)
+        {
+            route_target *next = t->next;
+            free(t);
+            t = next;
+        }
+    }
+    free(n->children);
+    free(n->first);
+    free(n);
+}
+
+// Walking down from n along the first len characters of pattern, splitting
+// edges and adding nodes as needed. Returns the node where the pattern ends.
+static chttp_route_node *node_insert(chttp_route_node *n, const char *pattern, size_t len)
+{
+    const char *p = pattern;
+    const char *end = pattern + len;
+    int params = 0;
+    while (p < end)
+    {
+        if (*p == ':')
+        {
+            // A parameter spans a whole segment.
+            const char *name = p + 1;
+            const char *name_end = name;
+            while (name_end < end && *name_end != '/')
+                name_end++;
+            size_t name_len = name_end - name;
+            if (p[-1] != '/' || name_len == 0 || memchr(name, ':', name_len) != NULL ||
+                ++params > CHTTP_ROUTE_PARAMS)
+                return NULL;
+
+            if (n->param == NULL)
+            {
+                if ((n->param = node_allocate(NULL, 0)) == NULL)
+                    return NULL;
+                n->param_name = name;
+                n->param_name_len = name_len;
+            } else if (n->param_name_len != name_len || memcmp(n->param_name, name, name_len) != 0)
+                return NULL;
+
+            n = n->param;
+            p = name_end;
+            continue;
+        }
+
+        // The static run up to the next parameter.
+        const char *run = p;
+        while (run < end && *run != ':')
+            run++;
+        size_t run_len = run - p;
+
+        int i = node_child(n, *p);
+        if (i < 0)
+        {
+            chttp_route_node *child = node_allocate(p, run_len);
+            if (child == NULL || node_add_child(n, child))
+            {
+                free(child);
+                return NULL;
+            }
+            n = child;
+            p = run;
+            continue;
+        }
+
+        chttp_route_node *child = n->children[i];
+        size_t common = 0;
+        while (common < child->label_len && common < run_len && child->label[common] == p[common])
+            common++;
+
+        // Splitting the edge where the pattern leaves it, so the shared part
+        // becomes a node of its own with the old child below it.
+        if (common < child->label_len)
+        {
+            chttp_route_node *mid = node_allocate(child->label, common);
+            if (mid == NULL)
+                return NULL;
+            child->label += common;
+            child->label_len -= common;
+            if (node_add_child(mid, child))
+            {
+                child->label -= common;
+                child->label_len += common;
+                free(mid);
+                return NULL;
+            }
+            n->children[i] = mid;
+            child = mid;
+        }
+
+        n = child;
+        p += common;
+    }
+    return n;
+}
+
+// Adding a target to one of a node's lists, refusing a second one for the
+// same method.
+static int target_add(route_target **list, int method, chttp_route_handler handler, void *data)
+{
+    for (route_target *t = *list; t != NULL; t = t->next)
+        if (t->method == method)
+            return -1;
+
+    route_target *t = (route_target *)malloc(sizeof(route_target));
+    if (t == NULL)
+        return -1;
+    t->method = method;
+    t->handler = handler;
+    t->data = data;
+
+    // Keeping CHTTP_ROUTE_ANY last, so specific methods are found first.
+    if (method == CHTTP_ROUTE_ANY)
+    {
+        while (*list != NULL)
+            list = &(*list)->next;
+    }
+    t->next = *list;
+    *list = t;
+    return 0;
+}
+
+// Collecting the methods a list has targets for, as bits by chttp_method,
+// with GET also allowing HEAD and CHTTP_ROUTE_ANY allowing everything.
+static int target_methods(const route_target *list)
+{
+    int allow = 0;
+    for (const route_target *t = list; t != NULL; t = t->next)
+    {
+        if (t->method == CHTTP_ROUTE_ANY)
+            return (1 << (OTHER + 1)) - 1;
+        allow |= 1 << t->method;
+        if (t->method == GET)
+            allow |= 1 << HEAD;
+    }
+    return allow;
+}
+
+// Finding the target for a method, with HEAD served by GET if need be.
+static const route_target *target_find(const route_target *list, chttp_method method)
+{
+    const route_target *get = NULL;
+    for (const route_target *t = list; t != NULL; t = t->next)
+    {
+        if (t->method == (int)method)
+            return t;
+        if (t->method == GET && method == HEAD)
+            get = t;
+        if (t->method == CHTTP_ROUTE_ANY)
+            return get ? get : t;
+    }
+    return get;
+}
+
+// Filling a router.
+int chttp_router_fill(chttp_router *r)
+{
+    r->root = node_allocate("", 0);
+    return r->root ? 0 : -1;
+}
+
+// Adding a route.
+int chttp_router_add(chttp_router *r, int method, const char *pattern, chttp_route_handler handler, void *data)
+{
+    if (pattern[0] != '/' || handler == NULL)
+        return -1;
+
+    chttp_route_node *n = node_insert(r->root, pattern, strlen(pattern));
+    return n ? target_add(&n->routes, method, handler, data) : -1;
+}
+
+// Mounting a handler on a prefix.
+int chttp_router_mount(chttp_router *r, int method, const char *prefix, chttp_route_handler handler, void *data)
+{
+    size_t len = strlen(prefix);
+    if (prefix[0] != '/' || memchr(prefix, ':', len) != NULL || handler == NULL)
+        return -1;
+    if (prefix[len - 1] == '/')
+        len--;
+
+    chttp_route_node *n = node_insert(r->root, prefix, len);
+    return n ? target_add(&n->mounts, method, handler, data) : -1;
+}
+
+// The state of a match in progress: the deepest mount passed so far, and
+// the methods of the routes for the whole path that did not take the method.
+typedef struct
+{
+    chttp_method method;
+    const route_target *mount;
+    const char *mount_rest;
+    size_t mount_rest_len;
+    int not_allowed;
+} match_state;
+
+// Matching the rest of a path below n, whose label has been consumed.
+// Static children are tried before the parameter, backtracking if they lead
+// nowhere. Returns the target, with its parameters left in m.
+static const route_target *node_match(const chttp_route_node *n, const char *path, size_t len, chttp_route_match *m,
+                                      match_state *st)
+{
+    // A mount applies only at a segment boundary.
+    if (n->mounts != NULL && (len == 0 || path[0] == '/'))
+    {
+        const route_target *t = target_find(n->mounts, st->method);
+        if (t != NULL)
+        {
+            st->mount = t;
+            st->mount_rest = path;
+            st->mount_rest_len = len;
+        } else
+            st->not_allowed |= target_methods(n->mounts);
+    }
+
+    if (len == 0)
+    {
+        const route_target *t = target_find(n->routes, st->method);
+        if (t == NULL)
+            st->not_allowed |= target_methods(n->routes);
+        return t;
+    }
+
+    int i = node_child(n, path[0]);
+    if (i >= 0)
+    {
+        const chttp_route_node *child = n->children[i];
+        if (child->label_len <= len && memcmp(child->label, path, child->label_len) == 0)
+        {
+            const route_target *t = node_match(child, path + child->label_len, len - child->label_len, m, st);
+            if (t != NULL)
+                return t;
+        }
+    }
+
+    if (n->param != NULL && path[0] != '/')
+    {
+        size_t seg = 0;
+        while (seg < len && path[seg] != '/')
+            seg++;
+
+        chttp_route_param *p = &m->params[m->param_count++];
+        p->name = n->param_name;
+        p->name_len = n->param_name_len;
+        p->value = path;
+        p->value_len = seg;
+        const route_target *t = node_match(n->param, path + seg, len - seg, m, st);
+        if (t != NULL)
+            return t;
+        m->param_count--;
+    }
+    return NULL;
+}
+
+// Matching a request.
+chttp_route_status chttp_router_match(const chttp_router *r, chttp_method method, const char *path, size_t len,
+                                      chttp_route_match *match)
+{
+    match_state st;
+    memset(&st, 0, sizeof(st));
+    st.method = method;
+    match->param_count = 0;
+
+    const route_target *t = node_match(r->root, path, len, match, &st);
+    if (t != NULL)
+    {
+        match->rest = NULL;
+        match->rest_len = 0;
+    } else if ((t = st.mount) != NULL)
+    {
+        // Mount prefixes have no parameters, and any captured on the way to a
+        // deeper route that failed do not count.
+        match->param_count = 0;
+        match->rest = st.mount_rest;
+        match->rest_len = st.mount_rest_len;
+    } else
+    {
+        match->allow = st.not_allowed;
+        return st.not_allowed ? CHTTP_ROUTE_METHOD_NOT_ALLOWED : CHTTP_ROUTE_NOT_FOUND;
+    }
+
+    match->handler = t->handler;
+    match->data = t->data;
+    match->allow = 0;
+    return CHTTP_ROUTE_FOUND;
+}
+
+// Freeing a router.
+void chttp_router_free(chttp_router *r)
+{
+    node_free(r->root);
+    r->root = NULL;
+}
+
+// Getting a path parameter.
+const char *chttp_route_get_param(const chttp_route_match *match, const char *name, size_t *len)
+{
+    size_t name_len = strlen(name);
+    for (int i = 0; i < match->param_count; i++)
+    {
+        const chttp_route_param *p = &match->params[i];
+        if (p->name_len == name_len && memcmp(p->name, name, name_len) == 0)
+        {
+            *len = p->value_len;
+            return p->value;
+        }
+    }
+    return NULL;
+}
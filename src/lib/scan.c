@@ -0,0 +1,151 @@
+#include "chttp_scan.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define CHTTP_SCAN_X86
+#include <immintrin.h>
+#endif
+
+typedef size_t (*scan_fn)(const char *buf, size_t len, char a, char b);
+
+// Whether c ends a scan: a delimiter, a control character other than HT, or
+// DEL.
+static inline int scan_stop(unsigned char c, char a, char b)
+{
+    return c == (unsigned char)a || c == (unsigned char)b ||
+        (c < 0x20 && c != '\t') || c == 0x7f;
+}
+
+// Scanning one byte at a time.
+size_t chttp_scan_scalar(const char *buf, size_t len, char a, char b)
+{
+    for (size_t i = 0; i < len; i++)
+        if (scan_stop((unsigned char)buf[i], a, b))
+            return i;
+    return len;
+}
+
+#ifdef CHTTP_SCAN_X86
+// Scanning 16 bytes at a time with SSE2. A byte is a control character when
+// its unsigned minimum with 0x1f is itself.
+__attribute__((target("sse2")))
+static size_t scan_sse2(const char *buf, size_t len, char a, char b)
+{
+    const __m128i va  = _mm_set1_epi8(a);
+    const __m128i vb  = _mm_set1_epi8(b);
+    const __m128i ctl = _mm_set1_epi8(0x1f);
+    const __m128i ht  = _mm_set1_epi8('\t');
+    const __m128i del = _mm_set1_epi8(0x7f);
+
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16)
+    {
+        __m128i x = _mm_loadu_si128((const __m128i *)(buf + i));
+        __m128i m = _mm_or_si128(_mm_cmpeq_epi8(x, va), _mm_cmpeq_epi8(x, vb));
+        __m128i c = _mm_cmpeq_epi8(_mm_min_epu8(x, ctl), x);
+        c = _mm_andnot_si128(_mm_cmpeq_epi8(x, ht), c);
+        m = _mm_or_si128(m, _mm_or_si128(c, _mm_cmpeq_epi8(x, del)));
+
+        int mask = _mm_movemask_epi8(m);
+        if (mask)
+            return i + __builtin_ctz(mask);
+    }
+
+    return i + chttp_scan_scalar(buf + i, len - i, a, b);
+}
+
+// Scanning 32 bytes at a time with AVX2.
+__attribute__((target("avx2")))
+static size_t scan_avx2(const char *buf, size_t len, char a, char b)
+{
+    const __m256i va  = _mm256_set1_epi8(a);
+    const __m256i vb  = _mm256_set1_epi8(b);
+    const __m256i ctl = _mm256_set1_epi8(0x1f);
+    const __m256i ht  = _mm256_set1_epi8('\t');
+    const __m256i del = _mm256_set1_epi8(0x7f);
+
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32)
+    {
+        __m256i x = _mm256_loadu_si256((const __m256i *)(buf + i));
+        __m256i m = _mm256_or_si256(_mm256_cmpeq_epi8(x, va), _mm256_cmpeq_epi8(x, vb));
+        __m256i c = _mm256_cmpeq_epi8(_mm256_min_epu8(x, ctl), x);
+        c = _mm256_andnot_si256(_mm256_cmpeq_epi8(x, ht), c);
+        m = _mm256_or_si256(m, _mm256_or_si256(c, _mm256_cmpeq_epi8(x, del)));
+
+        unsigned int mask = (unsigned int)_mm256_movemask_epi8(m);
+        if (mask)
+            return i + __builtin_ctz(mask);
+    }
+
+    return i + scan_sse2(buf + i, len - i, a, b);
+}
+#endif
+
+static scan_fn scan_impl_fn = NULL;
+static chttp_scan_impl scan_impl = CHTTP_SCAN_SCALAR;
+
+// Picking the widest implementation the CPU supports.
+static void scan_resolve()
+{
+    chttp_scan_impl impl = CHTTP_SCAN_SCALAR;
+#ifdef CHTTP_SCAN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        impl = CHTTP_SCAN_AVX2;
+    else if (__builtin_cpu_supports("sse2"))
+        impl = CHTTP_SCAN_SSE2;
+#endif
+    chttp_scan_select(impl);
+}
+
+// Dispatching to the selected implementation.
+size_t chttp_scan(const char *buf, size_t len, char a, char b)
+{
+    scan_fn fn = __atomic_load_n(&scan_impl_fn, __ATOMIC_RELAXED);
+    if (fn == NULL)
+    {
+        scan_resolve();
+        fn = __atomic_load_n(&scan_impl_fn, __ATOMIC_RELAXED);
+    }
+    return fn(buf, len, a, b);
+}
+
+// Forcing an implementation.
+int chttp_scan_select(chttp_scan_impl impl)
+{
+    scan_fn fn;
+    switch (impl)
+    {
+    case CHTTP_SCAN_SCALAR:
+        fn = &chttp_scan_scalar;
+        break;
+#ifdef CHTTP_SCAN_X86
+    case CHTTP_SCAN_SSE2:
+        __builtin_cpu_init();
+        if (!__builtin_cpu_supports("sse2"))
+            return -1;
+        fn = &scan_sse2;
+        break;
+    case CHTTP_SCAN_AVX2:
+        __builtin_cpu_init();
+        if (!__builtin_cpu_supports("avx2"))
+            return -1;
+        fn = &scan_avx2;
+        break;
+#endif
+    default:
+        return -1;
+    }
+
+    scan_impl = impl;
+    __atomic_store_n(&scan_impl_fn, fn, __ATOMIC_RELAXED);
+    return 0;
+}
+
+// Reporting the selected implementation.
+chttp_scan_impl chttp_scan_current()
+{
+    if (__atomic_load_n(&scan_impl_fn, __ATOMIC_RELAXED) == NULL)
+        scan_resolve();
+    return scan_impl;
+}
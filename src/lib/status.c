@@ -0,0 +1,107 @@
+#include "chttp.h"
+
+// A registered status code with its reason phrase and the whole HTTP/1.1
+// status line for it, rendered at compile time.
+typedef struct
+{
+    const char *line;
+    unsigned char line_len;
+    const char *reason;
+} status_entry;
+
+#define STATUS(code, reason)                                   \
+    [code - 100] = { "HTTP/1.1 " #code " " reason "\r\n",      \
+                     sizeof("HTTP/1.1 " #code " " reason "\r\n") - 1, reason }
+
+// The codes in the IANA HTTP status code registry, indexed from 100.
+static const status_entry status_table[500] = {
+    STATUS(100, "Continue"),
+    STATUS(101, "Switching Protocols"),
+    STATUS(102, "Processing"),
+    STATUS(103, "Early Hints"),
+    STATUS(200, "OK"),
+    STATUS(201, "Created"),
+    STATUS(202, "Accepted"),
+    STATUS(203, "Non-Authoritative Information"),
+    STATUS(204, "No Content"),
+    STATUS(205, "Reset Content"),
+    STATUS(206, "Partial Content"),
+    STATUS(207, "Multi-Status"),
+    STATUS(208, "Already Reported"),
+    STATUS(226, "IM Used"),
+    STATUS(300, "Multiple Choices"),
+    STATUS(301, "Moved Permanently"),
+    STATUS(302, "Found"),
+    STATUS(303, "See Other"),
+    STATUS(304, "Not Modified"),
+    STATUS(305, "Use Proxy"),
+    STATUS(307, "Temporary Redirect"),
+    STATUS(308, "Permanent Redirect"),
+    STATUS(400, "Bad Request"),
+    STATUS(401, "Unauthorized"),
+    STATUS(402, "Payment Required"),
+    STATUS(403, "Forbidden"),
+    STATUS(404, "Not Found"),
+    STATUS(405, "Method Not Allowed"),
+    STATUS(406, "Not Acceptable"),
+    STATUS(407, "Proxy Authentication Required"),
+    STATUS(408, "Request Timeout"),
+    STATUS(409, "Conflict"),
+    STATUS(410, "Gone"),
+    STATUS(411, "Length Required"),
+    STATUS(412, "Precondition Failed"),
+    STATUS(413, "Payload Too Large"),
+    STATUS(414, "URI Too Long"),
+    STATUS(415, "Unsupported Media Type"),
+    STATUS(416, "Range Not Satisfiable"),
+    STATUS(417, "Expectation Failed"),
+    STATUS(418, "I'm a teapot"),
+    STATUS(421, "Misdirected Request"),
+    STATUS(422, "Unprocessable Entity"),
+    STATUS(423, "Locked"),
+    STATUS(424, "Failed Dependency"),
+    STATUS(425, "Too Early"),
+    STATUS(426, "Upgrade Required"),
+    STATUS(428, "Precondition Required"),
+    STATUS(429, "Too Many Requests"),
+    STATUS(431, "Request Header Fields Too Large"),
+    STATUS(451, "Unavailable For Legal Reasons"),
+    STATUS(500, "Internal Server Error"),
+    STATUS(501, "Not Implemented"),
+    STATUS(502, "Bad Gateway"),
+    STATUS(503, "Service Unavailable"),
+    STATUS(504, "Gateway Timeout"),
+    STATUS(505, "HTTP Version Not Supported"),
+    STATUS(506, "Variant Also Negotiates"),
+    STATUS(507, "Insufficient Storage"),
+    STATUS(508, "Loop Detected"),
+    STATUS(510, "Not Extended"),
+    STATUS(511, "Network Authentication Required"),
+};
+
+#undef STATUS
+
+// Finding a code's entry, or NULL if it is not registered.
+static const status_entry *status_find(int code)
+{
+    if (code < 100 || code > 599 || status_table[code - 100].line == NULL)
+        return NULL;
+    return &status_table[code - 100];
+}
+
+// Getting the registered reason phrase of a status code.
+const char *chttp_status_reason(int code)
+{
+    const status_entry *e = status_find(code);
+    return e ? e->reason : NULL;
+}
+
+// Getting the pre-rendered status line of a status code.
+const char *chttp_status_line(int code, size_t *len)
+{
+    const status_entry *e = status_find(code);
+    if (e == NULL)
+        return NULL;
+    *len = e->line_len;
+    return e->line;
+}
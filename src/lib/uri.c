@@ -0,0 +1,250 @@
+#include "chttp.h"
+#include "chttp_scan.h"
+
+#include <string.h>
+
+// Splitting a request target.
+int chttp_uri_split(const char *uri, size_t len, chttp_uri *u)
+{
+    memset(u, 0, sizeof(chttp_uri));
+    if (len == 0)
+        return -1;
+
+    // The absolute form names the scheme and host before the path, which is
+    // empty if nothing follows the host.
+    size_t start = 0;
+    if (uri[0] != '/')
+    {
+        const char *sep = len > 3 ? (const char *)memmem(uri, len, "://", 3) : NULL;
+        if (sep == NULL || sep == uri)
+            return -1;
+        start = sep + 3 - uri;
+        while (start < len && uri[start] != '/' && uri[start] != '?' && uri[start] != '#')
+            start++;
+    }
+
+    size_t end = start + chttp_scan(uri + start, len - start, '?', '#');
+    u->path = uri + start;
+    u->path_len = end - start;
+    if (end < len && uri[end] == '?')
+    {
+        size_t q = end + 1;
+        end = q + chttp_scan(uri + q, len - q, '#', '#');
+        u->query = uri + q;
+        u->query_len = end - q;
+    }
+    if (end < len && uri[end] == '#')
+    {
+        u->fragment = uri + end + 1;
+        u->fragment_len = len - end - 1;
+    } else if (end < len)
+        return -1; // A control character.
+    return 0;
+}
+
+// Getting the value of a hex digit, or -1.
+static inline int hex_value(unsigned char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    c |= 0x20;
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    return -1;
+}
+
+// Percent-decoding a span.
+long chttp_percent_decode(char *dst, const char *src, size_t len, int plus)
+{
+    char b = plus ? '+' : '%';
+    size_t in = 0;
+    size_t out = 0;
+    while (in < len)
+    {
+        // Copying the run up to the next escape in one go; a span without
+        // any is found with one vectorized scan and copied once, or not at
+        // all when decoding in place.
+        size_t run = chttp_scan(src + in, len - in, '%', b);
+        if (dst + out != src + in)
+            memmove(dst + out, src + in, run);
+        in += run;
+        out += run;
+        if (in == len)
+            break;
+
+        char c = src[in];
+        if (c == '%')
+        {
+            int hi = in + 2 < len ? hex_value(src[in + 1]) : -1;
+            int lo = hi >= 0 ? hex_value(src[in + 2]) : -1;
+            if (lo < 0)
+                return -1;
+            dst[out++] = (char)(hi << 4 | lo);
+            in += 3;
+        } else
+        {
+            // A '+' standing for a space, or a control character the scan
+            // also stops at, which is kept as it is.
+            dst[out++] = c == '+' && plus ? ' ' : c;
+            in++;
+        }
+    }
+    return out;
+}
+
+// Normalizing the dot segments of a path.
+long chttp_path_normalize(char *path, size_t len)
+{
+    if (len == 0 || path[0] != '/')
+        return -1;
+
+    // Every segment is read once, after its '/', and written back at out or
+    // dropped; ".." moves out back to the start of the last segment written.
+    size_t in = 1;
+    size_t out = 0;
+    int slash = 1;
+    while (in <= len)
+    {
+        size_t end = in;
+        while (end < len && path[end] != '/')
+            end++;
+        size_t seg = end - in;
+        int last = end >= len;
+
+        if (seg == 0 || (seg == 1 && path[in] == '.'))
+            slash = last;
+        else if (seg == 2 && path[in] == '.' && path[in + 1] == '.')
+        {
+            if (out == 0)
+                return -1;
+            while (path[--out] != '/')
+                ;
+            slash = last;
+        } else
+        {
+            path[out++] = '/';
+            memmove(path + out, path + in, seg);
+            out += seg;
+            slash = 0;
+        }
+        in = end + 1;
+    }
+
+    // A path ending in a directory keeps its trailing slash, and the root is
+    // never empty.
+    if (slash || out == 0)
+        path[out++] = '/';
+    return out;
+}
+
+// Decoding and normalizing a path for use on the file system.
+long chttp_path_clean(char *path, size_t len)
+{
+    long n = chttp_percent_decode(path, path, len, 0);
+    if (n < 0 || memchr(path, '\0', n) != NULL)
+        return -1;
+    return chttp_path_normalize(path, n);
+}
+
+// Finding the first a or b in s, past any control characters chttp_scan also
+// stops at.
+static size_t span_find(const char *s, size_t len, char a, char b)
+{
+    size_t i = 0;
+    while ((i += chttp_scan(s + i, len - i, a, b)) < len && s[i] != a && s[i] != b)
+        i++;
+    return i;
+}
+
+// Comparing an encoded span to a plain string, decoding as it goes.
+static int span_equals(const char *s, size_t len, const char *str, size_t str_len)
+{
+    size_t i = 0;
+    size_t j = 0;
+    while (i < len && j < str_len)
+    {
+        char c = s[i];
+        if (c == '%')
+        {
+            int hi = i + 2 < len ? hex_value(s[i + 1]) : -1;
+            int lo = hi >= 0 ? hex_value(s[i + 2]) : -1;
+            if (lo < 0)
+                return 0;
+            c = (char)(hi << 4 | lo);
+            i += 3;
+        } else
+        {
+            if (c == '+')
+                c = ' ';
+            i++;
+        }
+        if (c != str[j++])
+            return 0;
+    }
+    return i == len && j == str_len;
+}
+
+// Starting to iterate over a query string or form body.
+void chttp_query_iter_init(chttp_query_iter *it, const char *s, size_t len)
+{
+    it->s = s;
+    it->len = len;
+    it->off = 0;
+}
+
+// Getting the next parameter.
+int chttp_query_next(chttp_query_iter *it, chttp_query_param *p)
+{
+    while (it->off < it->len)
+    {
+        const char *pair = it->s + it->off;
+        size_t pair_len = span_find(pair, it->len - it->off, '&', '&');
+        it->off += pair_len + 1;
+
+        // Empty pairs, as in "a=1&&b=2", are skipped.
+        if (pair_len == 0)
+            continue;
+
+        size_t key_len = span_find(pair, pair_len, '=', '=');
+        p->key = pair;
+        p->key_len = key_len;
+        if (key_len < pair_len)
+        {
+            p->value = pair + key_len + 1;
+            p->value_len = pair_len - key_len - 1;
+        } else
+        {
+            p->value = NULL;
+            p->value_len = 0;
+        }
+        return 1;
+    }
+    return 0;
+}
+
+// Finding the first parameter with a key.
+int chttp_query_find(const char *s, size_t len, const char *key, chttp_query_param *p)
+{
+    size_t key_len = strlen(key);
+    chttp_query_iter it;
+    chttp_query_iter_init(&it, s, len);
+    while (chttp_query_next(&it, p))
+    {
+        if (span_equals(p->key, p->key_len, key, key_len))
+            return 0;
+    }
+    return -1;
+}
+
+// Decoding a key or value.
+long chttp_query_decode(const char *span, size_t len, char *buf, size_t buf_len)
+{
+    // Decoding never lengthens a span, so this bounds the result.
+    if (len >= buf_len)
+        return -1;
+
+    long n = chttp_percent_decode(buf, span, len, 1);
+    if (n >= 0)
+        buf[n] = '\0';
+    return n;
+}